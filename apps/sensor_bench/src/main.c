@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+
+#include <ardesco.h>
+#include <stdio.h>
+#include <string.h>
+#include "accel_sensor.h"
+#include "env_sensor.h"
+#include "sensor_emul.h"
+
+#define READ_LOOPS			1000
+#define TRIGGER_EVENTS		200
+#define TRIGGER_ODR_HZ		100
+#define THROUGHPUT_MS		2000
+#define CACHED_READERS		10
+#define FIFO_WATERMARK		16
+#define FIFO_BURSTS			4
+
+// Label of the part env.c opens
+#define ENV_EMUL_DEV		"BME680"
+
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+// Pass limits for the nRF9160 at 64 MHz, loose enough for run to run
+// noise. A change that breaks one is a regression.
+#define MAX_READ_OVERHEAD_NS	20000
+#define MAX_TRIGGER_LATENCY_US	1000
+#define MIN_SAMPLES_PER_S		950
+#define MAX_MISSED				(THROUGHPUT_MS / 20)
+#define MAX_JITTER_US			500
+#endif //CONFIG_SENSOR_BENCH_TIMED
+
+// Constant waveforms for the functional checks, in milli-units. Y is
+// negative to cover the sign of the sensor_value conversion.
+static const int32_t accel_milli[3] = { 1250, -2500, 9807 };
+static const int32_t env_milli[3] = { 21500, 45250, 101325 };
+
+static volatile uint32_t trig_cnt;
+static volatile uint32_t trig_bad;
+static uint32_t trig_sum_us;
+static uint32_t trig_max_us;
+static volatile uint32_t ready_cnt;
+static uint32_t fifo_bursts;
+static uint32_t fifo_short;
+static uint32_t fifo_bad;
+static sensor_emul_dev_t *accel_emul;
+static sensor_emul_dev_t *env_emul;
+static K_SEM_DEFINE(trig_sem, 0, 1);
+static K_SEM_DEFINE(async_sem, 0, 2);
+static volatile uint32_t async_ok;
+static int failures;
+
+/*
+ * cyc_us - Cycles to us.
+ */
+static uint32_t cyc_us(uint32_t cycles)
+{
+	return (uint32_t)k_cyc_to_us_floor64(cycles);
+}
+
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+/*
+ * report - One result line. Grep for BENCH to compare runs.
+ */
+static void report(const char *name, uint32_t val, const char *unit)
+{
+	printk("BENCH %-24s %8u %s\n", name, val, unit);
+}
+#endif //CONFIG_SENSOR_BENCH_TIMED
+
+/*
+ * check - A result line with its limits. Counts a failure if val is
+ * outside lo..hi.
+ */
+static void check(const char *name, uint32_t val, const char *unit, uint32_t lo, uint32_t hi)
+{
+	bool ok = (val >= lo) && (val <= hi);
+
+	if (!ok)
+		failures++;
+	printk("BENCH %-24s %8u %-3s %s\n", name, val, unit, ok ? "pass" : "FAIL");
+}
+
+/*
+ * check_milli - Compares values read through the library with the
+ * waveforms they were played from.
+ */
+static void check_milli(const char *name, const int32_t *val, const int32_t *want, int n)
+{
+	uint32_t bad = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		if (val[i] != want[i])
+		{
+			printk("%s[%d] %d, expected %d\n", name, i, val[i], want[i]);
+			bad++;
+		}
+	}
+	check(name, bad, "", 0, 0);
+}
+
+/*
+ * set_waves - Plays constant values on the emulated accelerometer and
+ * BME680, so every read can be checked.
+ */
+static void set_waves(void)
+{
+	static const enum sensor_channel accel_ch[3] = {
+		SENSOR_CHAN_ACCEL_X, SENSOR_CHAN_ACCEL_Y, SENSOR_CHAN_ACCEL_Z
+	};
+	static const enum sensor_channel env_ch[3] = {
+		SENSOR_CHAN_AMBIENT_TEMP, SENSOR_CHAN_HUMIDITY, SENSOR_CHAN_PRESS
+	};
+	struct sensor_emul_wave wave = { .type = SENSOR_EMUL_CONST };
+
+	for (int i = 0; i < 3; i++)
+	{
+		wave.offset = accel_milli[i];
+		sensor_emul_set_wave(accel_emul, accel_ch[i], &wave);
+		wave.offset = env_milli[i];
+		sensor_emul_set_wave(env_emul, env_ch[i], &wave);
+	}
+}
+
+/*
+ * trig_handler - Trigger from the sensor library. Checks what it was
+ * passed and measures how long since the emulated part fired.
+ */
+static void trig_handler(uint32_t reason, void *data, int len, uint32_t userdata)
+{
+	uint32_t us = cyc_us(k_cycle_get_32() - sensor_emul_trigger_cycles(accel_emul));
+	struct sensor_trigger *trig = data;
+
+	if (trig_cnt >= TRIGGER_EVENTS)
+		return;
+	if ((reason != ARDCB_LIMITEXCEEDED) || (len != sizeof (struct sensor_trigger)) ||
+		(trig->type != SENSOR_TRIG_DATA_READY))
+		trig_bad++;
+	trig_sum_us += us;
+	trig_max_us = MAX(trig_max_us, us);
+	if (++trig_cnt == TRIGGER_EVENTS)
+		k_sem_give(&trig_sem);
+}
+
+/*
+ * fifo_handler - Watermark trigger. Drains the emulated FIFO and
+ * checks every sample in it.
+ */
+static void fifo_handler(uint32_t reason, void *data, int len, uint32_t userdata)
+{
+	// Too big for the work queue stack
+	static int32_t milli[SENSOR_EMUL_FIFO_SAMPLES][3];
+	int n;
+
+	if (fifo_bursts >= FIFO_BURSTS)
+		return;
+	n = sensor_emul_fifo_read(accel_emul, &milli[0][0], SENSOR_EMUL_FIFO_SAMPLES);
+	if (n < FIFO_WATERMARK)
+		fifo_short++;
+	for (int i = 0; i < n; i++)
+	{
+		if (memcmp (milli[i], accel_milli, sizeof (accel_milli)))
+			fifo_bad++;
+	}
+	if (++fifo_bursts == FIFO_BURSTS)
+		k_sem_give(&trig_sem);
+}
+
+/*
+ * async_handler - Sample from an asynchronous read. userdata is 0 for
+ * the BME680 and 1 for the accelerometer.
+ */
+static void async_handler(uint32_t reason, void *data, int len, uint32_t userdata)
+{
+	const int32_t *want = userdata ? accel_milli : env_milli;
+
+	if ((reason == ARDCB_DATAREADY) && (len == 3 * sizeof (int32_t)) &&
+		(memcmp (data, want, 3 * sizeof (int32_t)) == 0))
+		async_ok++;
+	k_sem_give(&async_sem);
+}
+
+//========================================================
+// Functional checks. Nothing here depends on how fast the
+// code runs, so they pass on native_posix as on a board.
+//========================================================
+
+/*
+ * test_reads - Values through the library are the ones played.
+ */
+static void test_reads(void *accel, void *env)
+{
+	accel_data_i32_t accel_data;
+	env_data_i32_t env_data;
+
+	ardaccel_read_i32(accel, &accel_data);
+	check_milli("accel_read", (int32_t *)&accel_data, accel_milli, 3);
+	ardenv_read_i32(env, &env_data);
+	check_milli("env_read", (int32_t *)&env_data, env_milli, 3);
+}
+
+/*
+ * test_trigger - Every data ready interrupt reaches the callback with
+ * its trigger.
+ */
+static void test_trigger(void *accel)
+{
+	struct sensor_trigger trig = {
+		.type = SENSOR_TRIG_DATA_READY,
+		.chan = SENSOR_CHAN_ALL,
+	};
+	struct sensor_value odr = { .val1 = TRIGGER_ODR_HZ };
+
+	sensor_attr_set(accel_emul, SENSOR_CHAN_ALL, SENSOR_ATTR_SAMPLING_FREQUENCY, &odr);
+	senlib_settrigger(accel, &trig, trig_handler, 0);
+	k_sem_take(&trig_sem, K_MSEC(10 * 1000 * TRIGGER_EVENTS / TRIGGER_ODR_HZ));
+	sensor_trigger_set(accel_emul, &trig, NULL);
+
+	check("trigger_events", trig_cnt, "", TRIGGER_EVENTS, TRIGGER_EVENTS);
+	check("trigger_bad", trig_bad, "", 0, 0);
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+	if (trig_cnt)
+	{
+		report("trigger_latency_mean", trig_sum_us / trig_cnt, "us");
+		check("trigger_latency_max", trig_max_us, "us", 0, MAX_TRIGGER_LATENCY_US);
+	}
+#endif //CONFIG_SENSOR_BENCH_TIMED
+}
+
+/*
+ * test_fifo - With a watermark set, the trigger comes once per
+ * watermark samples and the FIFO holds all of them.
+ */
+static void test_fifo(void *accel)
+{
+	struct sensor_trigger trig = {
+		.type = SENSOR_TRIG_DATA_READY,
+		.chan = SENSOR_CHAN_ALL,
+	};
+	struct sensor_emul_stats stats;
+
+	sensor_emul_set_watermark(accel_emul, FIFO_WATERMARK);
+	senlib_settrigger(accel, &trig, fifo_handler, 0);
+	k_sem_take(&trig_sem, K_MSEC(10 * 1000 * FIFO_BURSTS * FIFO_WATERMARK / TRIGGER_ODR_HZ));
+	sensor_trigger_set(accel_emul, &trig, NULL);
+	sensor_emul_get_stats(accel_emul, &stats);
+	sensor_emul_set_watermark(accel_emul, 0);
+
+	check("fifo_bursts", fifo_bursts, "", FIFO_BURSTS, FIFO_BURSTS);
+	check("fifo_short_bursts", fifo_short, "", 0, 0);
+	check("fifo_bad_samples", fifo_bad, "", 0, 0);
+	check("fifo_overruns", stats.fifo_overruns, "", 0, 0);
+}
+
+/*
+ * cached_reader - One of several modules reading the BME680 at once.
+ */
+static void cached_reader(void *p1, void *p2, void *p3)
+{
+	ardenv_read_i32_cached(p1, p3, 1000);
+	k_sem_give(p2);
+}
+
+K_THREAD_STACK_ARRAY_DEFINE(reader_stacks, CACHED_READERS, 1024);
+static struct k_thread readers[CACHED_READERS];
+static env_data_i32_t reader_data[CACHED_READERS];
+
+/*
+ * test_cache - Readers that start together share one conversion, and
+ * a read within the max age is served from the cache.
+ */
+static void test_cache(void *env)
+{
+	struct k_sem done;
+	struct senlib_cache_stats before, after;
+	env_data_i32_t data;
+	uint32_t size = sizeof (before);
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+	uint32_t start, single;
+
+	start = k_cycle_get_32();
+	ardenv_read_i32(env, &data);
+	single = cyc_us(k_cycle_get_32() - start);
+	report("env_read", single, "us");
+#endif //CONFIG_SENSOR_BENCH_TIMED
+
+	// Let the last sample age out first.
+	k_sleep(K_MSEC(1100));
+	ardenv_configure(env, ARDCONFIG_GETCACHESTATS, &before, &size);
+	k_sem_init(&done, 0, CACHED_READERS);
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+	start = k_cycle_get_32();
+#endif //CONFIG_SENSOR_BENCH_TIMED
+	for (int i = 0; i < CACHED_READERS; i++)
+		k_thread_create(&readers[i], reader_stacks[i], K_THREAD_STACK_SIZEOF(reader_stacks[i]),
+						cached_reader, env, &done, &reader_data[i], K_PRIO_PREEMPT(5), 0, K_NO_WAIT);
+	for (int i = 0; i < CACHED_READERS; i++)
+		k_sem_take(&done, K_FOREVER);
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+	// One shared conversion, not one each.
+	check("env_cached_readers", cyc_us(k_cycle_get_32() - start), "us", 0, single + single / 2);
+#endif //CONFIG_SENSOR_BENCH_TIMED
+
+	// Still young, so this one is a hit.
+	ardenv_read_i32_cached(env, &data, 1000);
+	ardenv_configure(env, ARDCONFIG_GETCACHESTATS, &after, &size);
+
+	for (int i = 0; i < CACHED_READERS; i++)
+		check_milli("env_cached_read", (int32_t *)&reader_data[i], env_milli, 3);
+	check_milli("env_cache_hit_read", (int32_t *)&data, env_milli, 3);
+	check("env_cache_misses", after.misses - before.misses, "", 1, 1);
+	check("env_cache_shared", (after.hits - before.hits) + (after.coalesced - before.coalesced), "",
+		  CACHED_READERS, CACHED_READERS);
+}
+
+/*
+ * test_async - Both sensors queued at once, each callback gets its
+ * own sample.
+ */
+static void test_async(void *accel, void *env)
+{
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+	accel_data_i32_t accel_data;
+	env_data_i32_t env_data;
+	uint32_t start, seq;
+
+	start = k_cycle_get_32();
+	ardenv_read_i32(env, &env_data);
+	ardaccel_read_i32(accel, &accel_data);
+	seq = cyc_us(k_cycle_get_32() - start);
+	report("sequential_reads", seq, "us");
+
+	start = k_cycle_get_32();
+#endif //CONFIG_SENSOR_BENCH_TIMED
+	ardenv_read_async(env, async_handler, 0);
+	ardaccel_read_async(accel, async_handler, 1);
+	k_sem_take(&async_sem, K_FOREVER);
+	k_sem_take(&async_sem, K_FOREVER);
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+	// The accel read hides behind the BME680 conversion, so only the
+	// queueing may cost anything.
+	check("async_reads", cyc_us(k_cycle_get_32() - start), "us", 0, seq + seq / 10);
+#endif //CONFIG_SENSOR_BENCH_TIMED
+	check("async_results", async_ok, "", 2, 2);
+}
+
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+//========================================================
+// Timed benchmarks, for a board only. Code runs in zero
+// time on native_posix, so k_cycle_get_32() only moves
+// while the CPU idles and every result would be meaningless.
+//========================================================
+
+/*
+ * bench_reads - Cost of a read through the library compared to
+ * calling the driver directly, with no conversion time.
+ */
+static void bench_reads(void *accel)
+{
+	struct sensor_value val[3];
+	accel_data_i32_t data;
+	uint32_t start, raw, lib, cached;
+
+	sensor_emul_set_latency(accel_emul, 0);
+
+	start = k_cycle_get_32();
+	for (int i = 0; i < READ_LOOPS; i++)
+	{
+		sensor_sample_fetch_chan(accel_emul, SENSOR_CHAN_ALL);
+		sensor_channel_get(accel_emul, SENSOR_CHAN_ACCEL_XYZ, val);
+	}
+	raw = k_cycle_get_32() - start;
+
+	start = k_cycle_get_32();
+	for (int i = 0; i < READ_LOOPS; i++)
+		ardaccel_read_i32(accel, &data);
+	lib = k_cycle_get_32() - start;
+
+	start = k_cycle_get_32();
+	for (int i = 0; i < READ_LOOPS; i++)
+		ardaccel_read_i32_cached(accel, &data, 1000);
+	cached = k_cycle_get_32() - start;
+
+	report("driver_read", cyc_us(raw) * 1000 / READ_LOOPS, "ns");
+	report("senlib_read", cyc_us(lib) * 1000 / READ_LOOPS, "ns");
+	check("senlib_read_overhead", (cyc_us(lib) - MIN(cyc_us(raw), cyc_us(lib))) * 1000 / READ_LOOPS, "ns",
+		  0, MAX_READ_OVERHEAD_NS);
+	report("senlib_read_cached", cyc_us(cached) * 1000 / READ_LOOPS, "ns");
+
+	sensor_emul_set_latency(accel_emul, CONFIG_SENSOR_EMUL_ADXL_LATENCY_US);
+}
+
+/*
+ * ready_handler - Periodic sample from the sensor library.
+ */
+static void ready_handler(uint32_t reason, void *data, int len, uint32_t userdata)
+{
+	if (reason == ARDCB_DATAREADY)
+		ready_cnt++;
+}
+
+/*
+ * bench_throughput - Samples per second periodic sampling keeps up
+ * with at a 1 ms period.
+ */
+static void bench_throughput(void *accel)
+{
+	struct accelsetcbstruct cb = {
+		.reasonflags = ARDCB_DATAREADY,
+		.fn = ready_handler,
+	};
+	struct senlib_period_stats stats;
+	uint32_t period = 1;
+	uint32_t size;
+
+	size = sizeof (cb);
+	ardaccel_configure(accel, ARDCONFIG_SETCALLBACK, &cb, &size);
+	ready_cnt = 0;
+	size = sizeof (period);
+	ardaccel_configure(accel, ARDCONFIG_SETMSRTIMER, &period, &size);
+	k_sleep(K_MSEC(THROUGHPUT_MS));
+	period = 0;
+	ardaccel_configure(accel, ARDCONFIG_SETMSRTIMER, &period, &size);
+
+	size = sizeof (stats);
+	ardaccel_configure(accel, ARDCONFIG_GETMSRSTATS, &stats, &size);
+	check("periodic_samples_per_s", ready_cnt * 1000 / THROUGHPUT_MS, "1/s", MIN_SAMPLES_PER_S, UINT32_MAX);
+	check("periodic_missed", stats.missed, "", 0, MAX_MISSED);
+	check("periodic_jitter_max", stats.jitter_max_us, "us", 0, MAX_JITTER_US);
+	report("periodic_jitter_mean", stats.samples ? stats.jitter_sum_us / stats.samples : 0, "us");
+}
+#endif //CONFIG_SENSOR_BENCH_TIMED
+
+//========================================================
+// Program Entry Point
+//========================================================
+void main(void)
+{
+	int rc = 0;
+	void *accel;
+	void *env;
+
+	printk("\nSensor library benchmark on emulated sensors.\n");
+
+	accel_emul = device_get_binding(ACCEL_8G_DEV);
+	env_emul = device_get_binding(ENV_EMUL_DEV);
+	accel = ardaccel_init(&rc, ACCEL_8G_DEV);
+	env = ardenv_init(&rc);
+	if ((accel_emul == 0) || (env_emul == 0) || (accel == 0) || (env == 0))
+	{
+		printk("Sensor init failed %d\n", rc);
+		return;
+	}
+	set_waves();
+
+	test_reads(accel, env);
+	test_trigger(accel);
+	test_fifo(accel);
+	test_cache(env);
+	test_async(accel, env);
+#ifdef CONFIG_SENSOR_BENCH_TIMED
+	bench_reads(accel);
+	bench_throughput(accel);
+#endif //CONFIG_SENSOR_BENCH_TIMED
+
+	printk("BENCH %s, %d failed\n", failures ? "FAIL" : "PASS", failures);
+}
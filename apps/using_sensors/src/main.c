@@ -4,8 +4,66 @@
 
 #include <ardesco.h>
 #include <stdio.h>
+#include <string.h>
 #include "accel_sensor.h"
 #include "env_sensor.h"
+#include "sample_codec.h"
+
+#define SAMPLE_PERIOD_MS	1000
+
+// Samples sent in one batch, and the schema id of the batch: 
+// temperature, humidity, pressure, x, y, z in milli-units.
+#define BATCH_SAMPLES		10
+#define SENSOR_SCHEMA_ID	1
+#define SENSOR_CHANNELS		6
+
+static env_data_i32_t envvals;
+static accel_data_i32_t accelvals;
+static K_SEM_DEFINE(accel_sem, 0, 1);
+
+/*
+ * milli_str - Formats a milli-unit value with two decimals.
+ */
+static char *milli_str(char *sz, int32_t val)
+{
+	uint32_t mag = (val < 0) ? -val : val;
+
+	sprintf (sz, "%s%u.%02u", (val < 0) ? "-" : "", mag / 1000, (mag % 1000) / 10);
+	return sz;
+}
+
+/*
+ * print_batch - Prints a batch as a hex string. lib/sample_codec/host
+ * has a decoder for it.
+ */
+static void print_batch(const uint8_t *buf, int len)
+{
+	printk ("batch 0x");
+	for (int i = 0; i < len; i++)
+		printk ("%02x", buf[i]);
+	printk ("\n");
+}
+
+/*
+ * env_data_handler - Called by the sensor library with each sample.
+ */
+static void env_data_handler(uint32_t reason, void *data, int len, uint32_t userdata)
+{
+	if ((reason == ARDCB_DATAREADY) && (len == sizeof (envvals)))
+		memcpy (&envvals, data, sizeof (envvals));
+}
+
+/*
+ * accel_data_handler - Called by the sensor library with each sample.
+ */
+static void accel_data_handler(uint32_t reason, void *data, int len, uint32_t userdata)
+{
+	if ((reason == ARDCB_DATAREADY) && (len == sizeof (accelvals)))
+	{
+		memcpy (&accelvals, data, sizeof (accelvals));
+		k_sem_give (&accel_sem);
+	}
+}
 
 //========================================================
 // Program Entry Point
@@ -43,17 +101,69 @@ void main(void)
 		}
 	}
 
-    double envvals[3];
-    double accelvals[3];
-	char sz[128];
+	// Both sensors are sampled every second by the sensor library.
+	// The callbacks save the latest sample and main prints them.
+	struct envsetcbstruct envcb = {
+		.reasonflags = ARDCB_DATAREADY,
+		.fn = env_data_handler,
+	};
+	struct accelsetcbstruct accelcb = {
+		.reasonflags = ARDCB_DATAREADY,
+		.fn = accel_data_handler,
+	};
+	uint32_t period = SAMPLE_PERIOD_MS;
+	uint32_t size;
+
+	size = sizeof (envcb);
+	ardenv_configure (env_dev, ARDCONFIG_SETCALLBACK, &envcb, &size);
+	size = sizeof (accelcb);
+	ardaccel_configure (accel_dev, ARDCONFIG_SETCALLBACK, &accelcb, &size);
+	size = sizeof (period);
+	ardenv_configure (env_dev, ARDCONFIG_SETMSRTIMER, &period, &size);
+	ardaccel_configure (accel_dev, ARDCONFIG_SETMSRTIMER, &period, &size);
+
+	struct senlib_period_stats stats;
+	struct sample_enc enc;
+	static uint8_t batch[BATCH_SAMPLES * SAMPLE_CODEC_MAX_RECORD + 16];
+	int32_t val[SENSOR_CHANNELS];
+	uint32_t text_len = 0;
+	char sz[6][16];
+	char line[128];
+
+	sample_enc_init (&enc, batch, sizeof (batch), SENSOR_CHANNELS);
 	while (1)
 	{
-		rc = ardenv_read (env_dev, &envvals, sizeof (envvals));
-		rc = ardaccel_read (accel_dev, &accelvals, sizeof (accelvals));
-		sprintf (sz, "%d  temp %.2f  Hum %.2f  Press %.2f     x %.2f  y %.2f  z %.2f\r\n", 
-				 rc, envvals[0], envvals[1], envvals[2], accelvals[0], accelvals[1], accelvals[2]);
-		printk ("%s", sz);
+		k_sem_take (&accel_sem, K_FOREVER);
+		sprintf (line, "temp %s  Hum %s  Press %s     x %s  y %s  z %s\r\n", 
+				 milli_str (sz[0], envvals.temperature), milli_str (sz[1], envvals.humidity),
+				 milli_str (sz[2], envvals.pressure), milli_str (sz[3], accelvals.x),
+				 milli_str (sz[4], accelvals.y), milli_str (sz[5], accelvals.z));
+		printk ("%s", line);
+		text_len += strlen (line);
+
+		// The same samples in the binary batch format.
+		val[0] = envvals.temperature;
+		val[1] = envvals.humidity;
+		val[2] = envvals.pressure;
+		val[3] = accelvals.x;
+		val[4] = accelvals.y;
+		val[5] = accelvals.z;
+		sample_enc_add (&enc, k_uptime_get_32(), val);
+		if (enc.count == BATCH_SAMPLES)
+		{
+			int len = sample_enc_finish (&enc, SENSOR_SCHEMA_ID, SAMPLE_CODEC_CBOR);
+
+			printk ("%d samples: %d bytes encoded, %u bytes as text\n", 
+					BATCH_SAMPLES, len, text_len);
+			print_batch (batch, len);
+			sample_enc_init (&enc, batch, sizeof (batch), SENSOR_CHANNELS);
+			text_len = 0;
+		}
 
-		k_sleep(K_MSEC(1000));
+		size = sizeof (stats);
+		ardaccel_configure (accel_dev, ARDCONFIG_GETMSRSTATS, &stats, &size);
+		if (stats.missed)
+			printk ("accel: %d samples, %d missed, jitter max %d us\n", 
+					stats.samples, stats.missed, stats.jitter_max_us);
 	}
 }
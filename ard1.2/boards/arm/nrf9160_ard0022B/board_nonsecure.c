@@ -21,7 +21,13 @@ LOG_MODULE_REGISTER(board_nonsecure, CONFIG_BOARD_LOG_LEVEL);
 				"3,729,757,5,758,820,6,815,862,"\
 				"2,859,895,0,896,980,1,1559,1916,"\
 				"3,1917,2100,6,2101,2200"
+#ifdef CONFIG_BSD_LIBRARY_TRACE_ENABLED
+// Coredump and LTE trace. The BSD library sends it out UARTE1 at
+// 1 Mbaud, on the MCU4/5 lines to the 52840.
+#define AT_CMD_TRACE		"AT%XMODEMTRACE=1,2"
+#else
 #define AT_CMD_TRACE		"AT%XMODEMTRACE=0"
+#endif
 // Used to configure modem for GPS use.
 #define AT_CMD_COEX0		"AT%XCOEX0=1,1,1570,1580"
 
@@ -19,7 +19,13 @@ LOG_MODULE_REGISTER(board_nonsecure, CONFIG_BOARD_LOG_LEVEL);
 #define AT_CMD_MAGPIO		"AT%XMAGPIO=1,1,1,7,1,746,803,2,698,748," \
 				"3,824,894,4,880,960,5,791,849,4,1710,2200," \
 				"7,1574,1577"
+#ifdef CONFIG_BSD_LIBRARY_TRACE_ENABLED
+// Coredump and LTE trace. The BSD library sends it out UARTE1 at
+// 1 Mbaud, on the MCU4/5 lines to the 52840.
+#define AT_CMD_TRACE		"AT%XMODEMTRACE=1,2"
+#else
 #define AT_CMD_TRACE		"AT%XMODEMTRACE=0"
+#endif
 // Used to configure modem for GPS use.
 #define AT_CMD_COEX0		"AT%XCOEX0=1,1,1570,1580"
 
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+
+#ifndef SENSOR_EMUL_H_
+#define SENSOR_EMUL_H_
+
+/**@file sensor_emul.h
+ *
+ * @brief Emulated ADXL362, ADXL372, BME680 and SHT35.
+ * @defgroup sensor_emul Emulated sensors
+ * @{
+ *
+ * Sensor drivers with the labels of the real parts, so the sensor
+ * library runs unchanged without the hardware, on native_posix or on
+ * a board. Each channel plays a
+ * waveform, fetches take as long as the part's conversion, and the
+ * data ready and threshold triggers fire from a timer at the sample
+ * rate (SENSOR_ATTR_SAMPLING_FREQUENCY).
+ */
+
+#include <zephyr.h>
+#include <device.h>
+#include <drivers/sensor.h>
+
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
+typedef struct device sensor_emul_dev_t;
+#else
+typedef const struct device sensor_emul_dev_t;
+#endif
+
+// Largest number of samples the emulated FIFO holds
+#define SENSOR_EMUL_FIFO_SAMPLES    170
+
+/* Waveforms */
+#define SENSOR_EMUL_CONST       0   // offset
+#define SENSOR_EMUL_SINE        1   // offset + amplitude * sin(2 pi t / period_ms)
+#define SENSOR_EMUL_RANDOM      2   // offset + uniform in +-amplitude
+#define SENSOR_EMUL_SCRIPT      3   // script[i], one every step_ms, repeated
+
+/**
+ * Waveform of one channel. Values are in milli-units of the channel,
+ * for example mm/s^2 or m°C.
+ */
+struct sensor_emul_wave {
+    uint8_t type;
+    int32_t offset;
+    int32_t amplitude;
+    uint32_t period_ms;
+    const int32_t *script;
+    uint16_t script_len;
+    uint16_t step_ms;
+};
+
+struct sensor_emul_stats {
+    uint32_t fetches;
+    uint32_t samples;           // Timer samples, also queued in the FIFO
+    uint32_t triggers;          // Handler calls
+    uint32_t fifo_overruns;     // Samples lost to a full FIFO
+};
+
+/**
+ * @brief Sets the waveform of a channel.
+ */
+int sensor_emul_set_wave(sensor_emul_dev_t *dev, enum sensor_channel chan,
+                         const struct sensor_emul_wave *wave);
+
+/**
+ * @brief Sets how long a fetch takes. Up to 1 ms it busy waits like
+ * a bus transfer, longer it sleeps like a conversion.
+ */
+int sensor_emul_set_latency(sensor_emul_dev_t *dev, uint32_t latency_us);
+
+/**
+ * @brief Fires the data ready trigger every watermark samples instead
+ * of every sample. Samples are kept in the FIFO until read. 0 turns
+ * the FIFO off.
+ */
+int sensor_emul_set_watermark(sensor_emul_dev_t *dev, uint16_t watermark);
+
+/**
+ * @brief Reads up to max samples from the FIFO, the channels of each
+ * sample one after the other in milli-units. Returns the samples read.
+ */
+int sensor_emul_fifo_read(sensor_emul_dev_t *dev, int32_t *milli, uint16_t max);
+
+/**
+ * @brief k_cycle_get_32() when the last trigger fired, to measure how
+ * long it took to reach the application.
+ */
+uint32_t sensor_emul_trigger_cycles(sensor_emul_dev_t *dev);
+
+int sensor_emul_get_stats(sensor_emul_dev_t *dev, struct sensor_emul_stats *stats);
+
+/**
+ * @}
+ */
+
+#endif /* SENSOR_EMUL_H_ */
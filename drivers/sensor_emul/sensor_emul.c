@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+
+/*
+ * Emulated sensors, for native_posix or a board. See sensor_emul.h.
+ *
+ * A fetch computes each channel's waveform at the current uptime and
+ * then waits out the part's conversion time. When a trigger is set, a
+ * timer runs at the sample rate. Each tick computes a sample, queues it
+ * in the FIFO if there is one, checks the thresholds and hands the
+ * handlers to the system work queue, as the real drivers do from
+ * their trigger thread.
+ */
+
+#include <zephyr.h>
+#include <device.h>
+#include <drivers/sensor.h>
+#include <string.h>
+#include <math.h>
+#include "sensor_emul.h"
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENSOR_INIT_PRIORITY
+#define CONFIG_SENSOR_INIT_PRIORITY 90
+#endif //CONFIG_SENSOR_INIT_PRIORITY
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENSOR_EMUL_ADXL_LATENCY_US
+#define CONFIG_SENSOR_EMUL_ADXL_LATENCY_US 60
+#endif //CONFIG_SENSOR_EMUL_ADXL_LATENCY_US
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENSOR_EMUL_BME680_LATENCY_US
+#define CONFIG_SENSOR_EMUL_BME680_LATENCY_US 190000
+#endif //CONFIG_SENSOR_EMUL_BME680_LATENCY_US
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENSOR_EMUL_SHT35_LATENCY_US
+#define CONFIG_SENSOR_EMUL_SHT35_LATENCY_US 15500
+#endif //CONFIG_SENSOR_EMUL_SHT35_LATENCY_US
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define EMUL_MAX_CHANNELS   4
+
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
+#define EMUL_DATA(dev)      ((struct emul_data *)(dev)->driver_data)
+#else
+#define EMUL_DATA(dev)      ((struct emul_data *)(dev)->data)
+#endif
+
+struct emul_chan {
+    enum sensor_channel chan;
+    struct sensor_emul_wave wave;
+};
+
+struct emul_data {
+    sensor_emul_dev_t *dev;
+    uint8_t nchan;
+    struct emul_chan ch[EMUL_MAX_CHANNELS];
+    int32_t cur[EMUL_MAX_CHANNELS];     // Values of the last fetch
+    uint32_t latency_us;
+    uint16_t odr_hz;
+    uint32_t seed;
+
+    // Triggers
+    struct k_timer timer;
+    struct k_work work;
+    sensor_trigger_handler_t drdy_handler;
+    struct sensor_trigger drdy_trig;
+    sensor_trigger_handler_t th_handler;
+    struct sensor_trigger th_trig;
+    int32_t upper;                      // Thresholds, milli-units
+    int32_t lower;
+    atomic_t pending;                   // Handlers to call, PEND_xxx
+    uint32_t fire_cycles;
+
+    // FIFO
+    uint16_t watermark;
+    uint16_t fifo_cnt;
+    uint16_t fifo_head;                 // Oldest sample
+    uint16_t since_drdy;
+    int32_t fifo[SENSOR_EMUL_FIFO_SAMPLES][EMUL_MAX_CHANNELS];
+
+    struct sensor_emul_stats stats;
+};
+
+#define PEND_DRDY       BIT(0)
+#define PEND_TH         BIT(1)
+
+//----------------------------------------------------
+// wave_value - Value of a waveform at t_ms.
+//----------------------------------------------------
+static int32_t wave_value(struct emul_data *data, const struct sensor_emul_wave *w, int64_t t_ms)
+{
+    switch (w->type)
+    {
+    case SENSOR_EMUL_SINE:
+        if (w->period_ms == 0)
+            return w->offset;
+        return w->offset + (int32_t)(w->amplitude *
+                                     sinf(2 * (float)M_PI * (t_ms % w->period_ms) / w->period_ms));
+    case SENSOR_EMUL_RANDOM:
+        // xorshift32, the same sequence on every run
+        data->seed ^= data->seed << 13;
+        data->seed ^= data->seed >> 17;
+        data->seed ^= data->seed << 5;
+        if (w->amplitude == 0)
+            return w->offset;
+        return w->offset + (int32_t)(data->seed % (2 * (uint32_t)w->amplitude + 1)) - w->amplitude;
+    case SENSOR_EMUL_SCRIPT:
+        if ((w->script == 0) || (w->script_len == 0))
+            return w->offset;
+        return w->script[(t_ms / MAX(w->step_ms, 1)) % w->script_len];
+    default:
+        return w->offset;
+    }
+}
+
+//----------------------------------------------------
+// find_chan - Index of chan, or -1.
+//----------------------------------------------------
+static int find_chan(struct emul_data *data, enum sensor_channel chan)
+{
+    for (int i = 0; i < data->nchan; i++)
+    {
+        if (data->ch[i].chan == chan)
+            return i;
+    }
+    return -1;
+}
+
+//----------------------------------------------------
+// emul_work_handler - Calls the trigger handlers.
+//----------------------------------------------------
+static void emul_work_handler(struct k_work *work)
+{
+    struct emul_data *data = CONTAINER_OF(work, struct emul_data, work);
+    atomic_val_t pend = atomic_clear(&data->pending);
+
+    if ((pend & PEND_DRDY) && data->drdy_handler)
+    {
+        data->stats.triggers++;
+        data->drdy_handler(data->dev, &data->drdy_trig);
+    }
+    if ((pend & PEND_TH) && data->th_handler)
+    {
+        data->stats.triggers++;
+        data->th_handler(data->dev, &data->th_trig);
+    }
+}
+
+//----------------------------------------------------
+// emul_timer_expiry - One sample period. Runs in the timer ISR.
+//----------------------------------------------------
+static void emul_timer_expiry(struct k_timer *timer)
+{
+    struct emul_data *data = CONTAINER_OF(timer, struct emul_data, timer);
+    int64_t now = k_uptime_get();
+    int32_t val[EMUL_MAX_CHANNELS];
+    atomic_val_t pend = 0;
+
+    for (int i = 0; i < data->nchan; i++)
+        val[i] = wave_value(data, &data->ch[i].wave, now);
+    data->stats.samples++;
+
+    if (data->watermark)
+    {
+        uint16_t tail = (data->fifo_head + data->fifo_cnt) % SENSOR_EMUL_FIFO_SAMPLES;
+
+        // Stream mode, the oldest sample goes when it is full.
+        memcpy (data->fifo[tail], val, sizeof (val));
+        if (data->fifo_cnt < SENSOR_EMUL_FIFO_SAMPLES)
+            data->fifo_cnt++;
+        else
+        {
+            data->fifo_head = (data->fifo_head + 1) % SENSOR_EMUL_FIFO_SAMPLES;
+            data->stats.fifo_overruns++;
+        }
+        if (++data->since_drdy >= data->watermark)
+        {
+            data->since_drdy = 0;
+            pend |= PEND_DRDY;
+        }
+    }
+    else
+        pend |= PEND_DRDY;
+
+    if (data->th_handler)
+    {
+        for (int i = 0; i < data->nchan; i++)
+        {
+            if ((val[i] > data->upper) || (val[i] < data->lower))
+                pend |= PEND_TH;
+        }
+    }
+
+    if (!data->drdy_handler)
+        pend &= ~PEND_DRDY;
+    if (pend)
+    {
+        data->fire_cycles = k_cycle_get_32();
+        atomic_or(&data->pending, pend);
+        k_work_submit(&data->work);
+    }
+}
+
+//----------------------------------------------------
+// emul_timer_update - Runs the timer while a trigger is set.
+//----------------------------------------------------
+static void emul_timer_update(struct emul_data *data)
+{
+    if ((data->drdy_handler || data->th_handler) && data->odr_hz)
+    {
+        k_timeout_t period = K_USEC(1000000 / data->odr_hz);
+
+        k_timer_start(&data->timer, period, period);
+    }
+    else
+        k_timer_stop(&data->timer);
+}
+
+static int emul_sample_fetch(sensor_emul_dev_t *dev, enum sensor_channel chan)
+{
+    struct emul_data *data = EMUL_DATA(dev);
+    int64_t now = k_uptime_get();
+
+    for (int i = 0; i < data->nchan; i++)
+        data->cur[i] = wave_value(data, &data->ch[i].wave, now);
+    data->stats.fetches++;
+
+    if (data->latency_us > 1000)
+        k_sleep(K_USEC(data->latency_us));
+    else if (data->latency_us)
+        k_busy_wait(data->latency_us);
+    return 0;
+}
+
+static int emul_channel_get(sensor_emul_dev_t *dev, enum sensor_channel chan,
+                            struct sensor_value *val)
+{
+    struct emul_data *data = EMUL_DATA(dev);
+    int first, cnt = 1;
+
+    if (chan == SENSOR_CHAN_ACCEL_XYZ)
+    {
+        first = find_chan(data, SENSOR_CHAN_ACCEL_X);
+        cnt = 3;
+    }
+    else
+        first = find_chan(data, chan);
+    if (first < 0)
+        return -ENOTSUP;
+
+    for (int i = 0; i < cnt; i++)
+    {
+        val[i].val1 = data->cur[first + i] / 1000;
+        val[i].val2 = (data->cur[first + i] % 1000) * 1000;
+    }
+    return 0;
+}
+
+static int emul_attr_set(sensor_emul_dev_t *dev, enum sensor_channel chan,
+                         enum sensor_attribute attr, const struct sensor_value *val)
+{
+    struct emul_data *data = EMUL_DATA(dev);
+    int32_t milli = val->val1 * 1000 + val->val2 / 1000;
+
+    switch (attr)
+    {
+    case SENSOR_ATTR_SAMPLING_FREQUENCY:
+        if (val->val1 <= 0)
+            return -EINVAL;
+        data->odr_hz = val->val1;
+        emul_timer_update(data);
+        return 0;
+    case SENSOR_ATTR_UPPER_THRESH:
+        data->upper = milli;
+        return 0;
+    case SENSOR_ATTR_LOWER_THRESH:
+        data->lower = milli;
+        return 0;
+    default:
+        return -ENOTSUP;
+    }
+}
+
+static int emul_trigger_set(sensor_emul_dev_t *dev, const struct sensor_trigger *trig,
+                            sensor_trigger_handler_t handler)
+{
+    struct emul_data *data = EMUL_DATA(dev);
+
+    switch (trig->type)
+    {
+    case SENSOR_TRIG_DATA_READY:
+        data->drdy_handler = handler;
+        data->drdy_trig = *trig;
+        break;
+    case SENSOR_TRIG_THRESHOLD:
+        data->th_handler = handler;
+        data->th_trig = *trig;
+        break;
+    default:
+        return -ENOTSUP;
+    }
+    emul_timer_update(data);
+    return 0;
+}
+
+static const struct sensor_driver_api emul_api = {
+    .attr_set = emul_attr_set,
+    .trigger_set = emul_trigger_set,
+    .sample_fetch = emul_sample_fetch,
+    .channel_get = emul_channel_get,
+};
+
+static int emul_init(sensor_emul_dev_t *dev)
+{
+    struct emul_data *data = EMUL_DATA(dev);
+
+    data->dev = dev;
+    data->seed = 0x2545F491 ^ (uint32_t)(uintptr_t)dev;
+    data->upper = INT32_MAX;
+    data->lower = INT32_MIN;
+    k_timer_init(&data->timer, emul_timer_expiry, NULL);
+    k_work_init(&data->work, emul_work_handler);
+    return 0;
+}
+
+int sensor_emul_set_wave(sensor_emul_dev_t *dev, enum sensor_channel chan,
+                         const struct sensor_emul_wave *wave)
+{
+    struct emul_data *data = EMUL_DATA(dev);
+    int i = find_chan(data, chan);
+    unsigned int key;
+
+    if (i < 0)
+        return -ENOTSUP;
+    key = irq_lock();
+    data->ch[i].wave = *wave;
+    irq_unlock(key);
+    return 0;
+}
+
+int sensor_emul_set_latency(sensor_emul_dev_t *dev, uint32_t latency_us)
+{
+    EMUL_DATA(dev)->latency_us = latency_us;
+    return 0;
+}
+
+int sensor_emul_set_watermark(sensor_emul_dev_t *dev, uint16_t watermark)
+{
+    struct emul_data *data = EMUL_DATA(dev);
+    unsigned int key;
+
+    if (watermark > SENSOR_EMUL_FIFO_SAMPLES)
+        return -EINVAL;
+    key = irq_lock();
+    data->watermark = watermark;
+    data->fifo_cnt = 0;
+    data->fifo_head = 0;
+    data->since_drdy = 0;
+    irq_unlock(key);
+    return 0;
+}
+
+int sensor_emul_fifo_read(sensor_emul_dev_t *dev, int32_t *milli, uint16_t max)
+{
+    struct emul_data *data = EMUL_DATA(dev);
+    unsigned int key = irq_lock();
+    int n = MIN(max, data->fifo_cnt);
+
+    for (int i = 0; i < n; i++)
+    {
+        memcpy (&milli[i * data->nchan], data->fifo[data->fifo_head], data->nchan * sizeof (int32_t));
+        data->fifo_head = (data->fifo_head + 1) % SENSOR_EMUL_FIFO_SAMPLES;
+    }
+    data->fifo_cnt -= n;
+    irq_unlock(key);
+    return n;
+}
+
+uint32_t sensor_emul_trigger_cycles(sensor_emul_dev_t *dev)
+{
+    return EMUL_DATA(dev)->fire_cycles;
+}
+
+int sensor_emul_get_stats(sensor_emul_dev_t *dev, struct sensor_emul_stats *stats)
+{
+    memcpy (stats, &EMUL_DATA(dev)->stats, sizeof (struct sensor_emul_stats));
+    return 0;
+}
+
+// Still, flat and level: 1 g on Z, a little vibration on X.
+#define EMUL_ACCEL(odr)                                                                     \
+    {                                                                                       \
+        .nchan = 3,                                                                         \
+        .ch = {                                                                             \
+            { SENSOR_CHAN_ACCEL_X, { .type = SENSOR_EMUL_SINE, .amplitude = 200, .period_ms = 50 } }, \
+            { SENSOR_CHAN_ACCEL_Y, { .type = SENSOR_EMUL_RANDOM, .amplitude = 20 } },      \
+            { SENSOR_CHAN_ACCEL_Z, { .type = SENSOR_EMUL_CONST, .offset = 9807 } },        \
+        },                                                                                  \
+        .latency_us = CONFIG_SENSOR_EMUL_ADXL_LATENCY_US,                                   \
+        .odr_hz = odr,                                                                      \
+    }
+
+static struct emul_data adxl362_data = EMUL_ACCEL(100);
+static struct emul_data adxl372_data = EMUL_ACCEL(400);
+
+// An office day: temperature and humidity drift slowly.
+static struct emul_data bme680_data = {
+    .nchan = 4,
+    .ch = {
+        { SENSOR_CHAN_AMBIENT_TEMP, { .type = SENSOR_EMUL_SINE, .offset = 22000, .amplitude = 1500, .period_ms = 600000 } },
+        { SENSOR_CHAN_HUMIDITY, { .type = SENSOR_EMUL_SINE, .offset = 40000, .amplitude = 5000, .period_ms = 900000 } },
+        { SENSOR_CHAN_PRESS, { .type = SENSOR_EMUL_RANDOM, .offset = 101325, .amplitude = 10 } },
+        { SENSOR_CHAN_GAS_RES, { .type = SENSOR_EMUL_RANDOM, .offset = 50000000, .amplitude = 500000 } },
+    },
+    .latency_us = CONFIG_SENSOR_EMUL_BME680_LATENCY_US,
+    .odr_hz = 1,
+};
+
+static struct emul_data sht35_data = {
+    .nchan = 2,
+    .ch = {
+        { SENSOR_CHAN_AMBIENT_TEMP, { .type = SENSOR_EMUL_SINE, .offset = 21500, .amplitude = 1000, .period_ms = 600000 } },
+        { SENSOR_CHAN_HUMIDITY, { .type = SENSOR_EMUL_SINE, .offset = 45000, .amplitude = 3000, .period_ms = 900000 } },
+    },
+    .latency_us = CONFIG_SENSOR_EMUL_SHT35_LATENCY_US,
+    .odr_hz = 1,
+};
+
+DEVICE_AND_API_INIT(emul_adxl362, "ADXL362", emul_init, &adxl362_data, NULL,
+                    POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY, &emul_api);
+DEVICE_AND_API_INIT(emul_adxl372, "ADXL372", emul_init, &adxl372_data, NULL,
+                    POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY, &emul_api);
+DEVICE_AND_API_INIT(emul_bme680, "BME680", emul_init, &bme680_data, NULL,
+                    POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY, &emul_api);
+DEVICE_AND_API_INIT(emul_sht35, "SHT35", emul_init, &sht35_data, NULL,
+                    POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY, &emul_api);
@@ -17,12 +17,28 @@ extern "C" {
 #define ACCEL_8G_DEV         "ADXL362"
 #define ACCEL_200G_DEV       "ADXL372"
 
+// Structure to pass accel data in fixed point
+typedef struct {
+	int32_t x;			/**< X-axis acceleration [mm/s^2]. */
+	int32_t y;			/**< y-axis acceleration [mm/s^2]. */
+	int32_t z;			/**< z-axis acceleration [mm/s^2]. */
+} accel_data_i32_t;
+
+// Compact accel data. Saturates at +/-327 m/s^2 (33 g).
+typedef struct {
+	int16_t x;			/**< X-axis acceleration [cm/s^2]. */
+	int16_t y;			/**< y-axis acceleration [cm/s^2]. */
+	int16_t z;			/**< z-axis acceleration [cm/s^2]. */
+} accel_data_i16_t;
+
+#ifdef CONFIG_SENLIB_DOUBLE_API
 // Structure to pass accel data
 typedef struct {
 	double x;			/**< X-axis acceleration [m/s^2]. */
 	double y;			/**< y-axis acceleration [m/s^2]. */
 	double z;			/**< z-axis acceleration [m/s^2]. */
 } accel_data_t;
+#endif //CONFIG_SENLIB_DOUBLE_API
 
 
 // Setcallback structure
@@ -32,12 +48,121 @@ struct accelsetcbstruct {
     uint32_t userdata;
 };
 
+// Library specific config functions
+#define ARDCONFIG_ACCEL_SETFIFO     (ARDCONFIG_LIBSPECIFIC + 0)
+#define ARDCONFIG_ACCEL_SETMOTION   (ARDCONFIG_LIBSPECIFIC + 1)
+
+// One sample from the FIFO. Multiply by mg_per_lsb for milli-g.
+struct accel_fifo_sample {
+    uint32_t timestamp;     // us since boot when the sample was taken
+    int16_t x;
+    int16_t y;
+    int16_t z;
+};
+
+// FIFO burst configuration. Passed to ardaccel_fifo_start or with
+// ARDCONFIG_ACCEL_SETFIFO.
+struct accel_fifo_cfg {
+    uint16_t odr_hz;        // Sample rate. Rounded up to one the part has, set on return
+    uint16_t watermark;     // Samples per burst, at most 170
+    struct accel_fifo_sample *buf;  // Caller's array the bursts are read to
+    uint16_t buf_len;       // Samples buf holds, at least watermark
+    uint16_t mg_per_lsb;    // Set on return
+    // Called on the sensor work queue with ARDCB_DATAREADY, buf and
+    // the bytes read for each burst.
+    SenLib_trigger_fn fn;
+    uint32_t userdata;
+};
+
+// FIFO burst counters
+struct accel_fifo_stats {
+    uint32_t samples;
+    uint32_t bursts;
+    uint32_t overruns;      // FIFO filled before it was drained
+    uint32_t resyncs;       // Entries skipped to line up the axes
+};
+
+// Sensors whose periodic sampling motion wake can pause
+#define ACCEL_MOTION_MAX_GATED  4
+
+// Motion wake configuration. Passed to ardaccel_motion_start or with
+// ARDCONFIG_ACCEL_SETMOTION. ADXL362 only.
+struct accel_motion_cfg {
+    uint16_t act_mg;        // Motion starts above this
+    uint16_t act_ms;        // for this long
+    uint16_t inact_mg;      // Motion stops below this
+    uint32_t inact_ms;      // for this long
+    // Compare with the acceleration when detection started instead of
+    // with 0 g, so gravity and the mounting angle don't count.
+    bool referenced;
+    // Periodic sampling of these sensor library handles is stopped
+    // when motion stops and set to gated_period_ms when it starts.
+    void *gated[ACCEL_MOTION_MAX_GATED];
+    uint32_t gated_period_ms[ACCEL_MOTION_MAX_GATED];
+    // Called on the sensor work queue with ARDCB_CHANGED and a
+    // struct accel_motion_event when motion starts or stops.
+    SenLib_trigger_fn fn;
+    uint32_t userdata;
+};
+
+struct accel_motion_event {
+    uint32_t timestamp;     // us since boot
+    bool moving;
+};
+
+// Axis analysed by ardaccel_spectrum_start
+#define ACCEL_AXIS_X        0
+#define ACCEL_AXIS_Y        1
+#define ACCEL_AXIS_Z        2
+#define ACCEL_AXIS_MAG      3   // Length of the XYZ vector
+
+// Vibration spectrum configuration. Passed to ardaccel_spectrum_start.
+struct accel_spectrum_cfg {
+    uint16_t odr_hz;        // FIFO sample rate, set on return
+    uint16_t watermark;     // Samples per FIFO burst, 0 for a default
+    uint8_t axis;           // ACCEL_AXIS_xxx
+    uint16_t mg_per_lsb;    // Set on return. Features are in LSB.
+    // fs_hz is set from odr_hz. fn is called on the sensor work queue
+    // with ARDCB_DATAREADY and a struct senlib_spectrum_features for
+    // each window.
+    struct senlib_spectrum_cfg spectrum;
+};
+
 void *ardaccel_init(int *prc, char *driver_name);
 //void *ardaccel_init(int *prc);
 int ardaccel_deinit(void *h);
+int ardaccel_read_i32 (void *h, accel_data_i32_t *pData);
+int ardaccel_read_i32_cached (void *h, accel_data_i32_t *pData, uint32_t max_age_ms);
+int ardaccel_read_async (void *h, SenLib_trigger_fn fn, uint32_t userdata);
+int ardaccel_read_i16 (void *h, accel_data_i16_t *pData);
+#ifdef CONFIG_SENLIB_DOUBLE_API
 int ardaccel_read (void *h, void *pData, int nSize);
+#endif //CONFIG_SENLIB_DOUBLE_API
 int ardaccel_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize);
 
+// FIFO burst mode. The ADXL362 runs at up to 400 Hz, the ADXL372
+// from 400 Hz to 6400 Hz.
+int ardaccel_fifo_start(void *h, struct accel_fifo_cfg *cfg);
+// Once it returns 0 no burst callback is running or queued, so
+// cfg.buf can be freed. From the sensor work queue, e.g. the burst
+// callback, it can't wait and returns -EDEADLK: the FIFO is stopped,
+// but cfg.buf must be kept until the callback has returned.
+int ardaccel_fifo_stop(void *h);
+int ardaccel_fifo_get_stats(void *h, struct accel_fifo_stats *stats);
+
+// Vibration spectrum features computed from FIFO bursts. Uses the
+// FIFO, so it can't run at the same time as ardaccel_fifo_start.
+int ardaccel_spectrum_start(void *h, struct accel_spectrum_cfg *cfg);
+// Can't be called from the feature callback, which runs on the sensor
+// work queue (-EDEADLK).
+int ardaccel_spectrum_stop(void *h);
+
+// Motion wake. The ADXL362 watches for motion by itself and raises
+// INT1 when it starts or stops. Uses INT1 like the FIFO, so it can't
+// run at the same time as ardaccel_fifo_start.
+int ardaccel_motion_start(void *h, struct accel_motion_cfg *cfg);
+int ardaccel_motion_stop(void *h);
+
 #ifdef __cplusplus
 }
 #endif
@@ -63,9 +63,13 @@ static inline void ard_free(void *mem) {
 #define ARDCONFIG_GETFREQUENCY      5
 #define ARDCONFIG_SETLIMIT          6
 #define ARDCONFIG_GETLIMIT          7
+#define ARDCONFIG_GETMSRSTATS       8
+#define ARDCONFIG_SETSTATS          9
+#define ARDCONFIG_GETSTATS          10
+#define ARDCONFIG_GETCACHESTATS     11
 
 // Library specific config functions start at the value below
-#define ARDCONFIG_LIBSPECIFIC  0080
+#define ARDCONFIG_LIBSPECIFIC  0x0080
 
 /**
  * @}
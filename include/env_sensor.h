@@ -12,17 +12,39 @@ extern "C" {
 #include <zephyr/types.h>
 #include "sensor_common.h"
 
+// Structure to pass env data in fixed point
+typedef struct {
+	int32_t temperature;	/**< [m°C] */
+	int32_t humidity;		/**< [m%RH] */
+	int32_t pressure;		/**< [Pa] */
+} env_data_i32_t;
+
+// Compact env data
+typedef struct {
+	int16_t temperature;	/**< [0.01 °C] */
+	int16_t humidity;		/**< [0.01 %RH] */
+	int16_t pressure;		/**< [10 Pa] */
+} env_data_i16_t;
+
+#ifdef CONFIG_SENLIB_DOUBLE_API
 // Structure to pass env data
 typedef struct {
 	double temperature;	
 	double humidity;	
 	double pressure;	
 } env_data_t;
+#endif //CONFIG_SENLIB_DOUBLE_API
 
 
 void *ardenv_init(int *prc);
 int ardenv_deinit(void *h);
+int ardenv_read_i32 (void *h, env_data_i32_t *pData);
+int ardenv_read_i32_cached (void *h, env_data_i32_t *pData, uint32_t max_age_ms);
+int ardenv_read_async (void *h, SenLib_trigger_fn fn, uint32_t userdata);
+int ardenv_read_i16 (void *h, env_data_i16_t *pData);
+#ifdef CONFIG_SENLIB_DOUBLE_API
 int ardenv_read (void *h, void *pData, int nSize);
+#endif //CONFIG_SENLIB_DOUBLE_API
 int ardenv_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize);
 
 #ifdef __cplusplus
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+
+#ifndef SAMPLE_CODEC_H__
+#define SAMPLE_CODEC_H__
+
+/**@file sample_codec.h
+ *
+ * @brief Compact binary encoding of timestamped sensor samples.
+ *
+ * A batch is a header followed by one record per sample:
+ *
+ *   version (1 byte), channels (varint)
+ *   per sample: timestamp delta of delta, then each channel's delta
+ *               from the last sample, all as zigzag varints
+ *
+ * The first sample carries its absolute timestamp and values, and
+ * the second the first period. Steady periods and slowly changing
+ * values then code to a byte each.
+ *
+ * With SAMPLE_CODEC_CBOR the batch is wrapped in a CBOR array of the
+ * schema id and the batch as a byte string, [uint, bstr].
+ *
+ * The code depends only on the C library, so the decoder also builds
+ * on Linux (see lib/sample_codec/host).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAMPLE_CODEC_VERSION        1
+#define SAMPLE_CODEC_MAX_CHANNELS   8
+
+// Longest record of one sample: 10 byte varints
+#define SAMPLE_CODEC_MAX_RECORD     (10 * (SAMPLE_CODEC_MAX_CHANNELS + 1))
+
+/* sample_enc_finish flags */
+#define SAMPLE_CODEC_CBOR           0x01    // Wrap in the CBOR envelope
+
+/**
+ * Encoder state. The batch is written to buf as samples are added.
+ */
+struct sample_enc {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    uint8_t channels;
+    uint32_t count;
+    uint32_t last_ts;
+    int64_t last_dt;
+    int32_t last[SAMPLE_CODEC_MAX_CHANNELS];
+};
+
+/**
+ * Decoder state.
+ */
+struct sample_dec {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    uint32_t schema_id;         // 0 without an envelope
+    uint8_t channels;
+    uint32_t count;
+    uint32_t last_ts;
+    int64_t last_dt;
+    int32_t last[SAMPLE_CODEC_MAX_CHANNELS];
+};
+
+/**
+ * @brief Starts a batch in buf. Leave room for the envelope, up to
+ * 11 bytes, if it is to be added.
+ *
+ * @return 0, -EINVAL for more than SAMPLE_CODEC_MAX_CHANNELS or
+ * -ENOSPC if buf can't hold the header.
+ */
+int sample_enc_init(struct sample_enc *e, uint8_t *buf, size_t size, uint8_t channels);
+
+/**
+ * @brief Adds a sample of e->channels values.
+ *
+ * @return 0 or -ENOSPC, in which case the batch is left as it was.
+ */
+int sample_enc_add(struct sample_enc *e, uint32_t timestamp, const int32_t *val);
+
+/**
+ * @brief Ends the batch.
+ *
+ * @return Length of the batch in buf, or -ENOSPC if the envelope
+ * doesn't fit.
+ */
+int sample_enc_finish(struct sample_enc *e, uint32_t schema_id, uint32_t flags);
+
+/**
+ * @brief Starts decoding a batch, with or without the envelope.
+ *
+ * @return 0 or -EBADMSG.
+ */
+int sample_dec_init(struct sample_dec *d, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Decodes the next sample into d->channels values.
+ *
+ * @return 1 for a sample, 0 at the end of the batch or -EBADMSG.
+ */
+int sample_dec_next(struct sample_dec *d, uint32_t *timestamp, int32_t *val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLE_CODEC_H__ */
@@ -6,6 +6,7 @@
 #define ARD_SERIAL_52LIB_H__
 
 #include <device.h>
+#include <usb/usb_device.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,6 +47,10 @@ typedef void (*uart_isr_handler) (void *user_data);
 struct serial_isr_info {
     uart_isr_handler irq_fn;
     void *user_data;
+    // Filled in by the library when CONFIG_SERIAL_52LIB_ISR_STATS
+    // is set. Execution time is in CPU cycles.
+    uint32_t isr_cnt;
+    uint32_t isr_max_cycles;
 };
 
 /*
@@ -62,6 +67,18 @@ void serial_lib_register_isr (struct device *dev, struct serial_isr_info *isr_in
 void serial_lib_register_isr (const struct device *dev, struct serial_isr_info *isr_info);
 #endif
 
+/*
+ * Clears the ISR execution time statistics of a registered ISR.
+ */
+void serial_lib_clear_isr_stats (struct serial_isr_info *isr_info);
+
+/*
+ * Called to have USB status changes (VBUS detect/removal etc.)
+ * passed on to the application. USB_active and power_event_sem
+ * are updated before cb is called.
+ */
+void serial_lib_set_usb_status_cb(usb_dc_status_callback cb);
+
 /*
  * Called to initialize the USB. This function can be called 
  * multiple times but will only initialize the USB once.
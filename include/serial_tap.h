@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+
+#ifndef ARD_SERIAL_TAP_H__
+#define ARD_SERIAL_TAP_H__
+
+#include <device.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Check that we're being used in the right place.
+#ifndef CONFIG_SOC_NRF52840
+#error serial_tap should only be included with 52840 applications.
+#endif
+
+/*
+ * Port numbers recorded with each chunk. usb_uart_52lib pairs
+ * use their index, starting at SERIAL_TAP_PORT_BRIDGE.
+ */
+#define SERIAL_TAP_PORT_BRIDGE  0
+#define SERIAL_TAP_PORT_IPC     15
+
+/*
+ * Direction of a chunk as seen from the 9160 link.
+ */
+#define SERIAL_TAP_DIR_TO_9160    0
+#define SERIAL_TAP_DIR_FROM_9160  1
+
+/*
+ * Pseudo header in front of the data of every packet in the
+ * pcap stream (LINKTYPE_USER0). All fields are little endian.
+ */
+struct serial_tap_pcap_hdr {
+	uint32_t cycles;    // DWT cycle counter when the chunk was seen
+	uint8_t port;
+	uint8_t dir;
+	uint16_t len;       // Length of the chunk before truncation
+} __packed;
+
+/*
+ * Capture counters.
+ */
+struct serial_tap_stats {
+	uint32_t records;   // Chunks recorded
+	uint32_t dropped;   // Chunks lost because the buffer was full
+	uint32_t truncated; // Chunks longer than a record
+};
+
+#ifdef CONFIG_SERIAL_52LIB_TAP
+/*
+ * Records a chunk. Safe to call from ISRs and threads.
+ */
+void serial_tap_record(uint8_t port, uint8_t dir, const uint8_t *data, uint32_t len);
+#else
+static inline void serial_tap_record(uint8_t port, uint8_t dir,
+                                     const uint8_t *data, uint32_t len) { }
+#endif
+
+/*
+ * Turns recording on or off. Recording is on after init.
+ */
+void serial_tap_enable(bool enable);
+
+/*
+ * Starts streaming the captured chunks, in pcap format, out
+ * a CDC ACM device such as "CDC_ACM_2". Returns 0 or a
+ * negative error.
+ */
+int serial_tap_stream_start(const char *dev_name);
+
+/*
+ * Stops streaming. Captured chunks stay buffered.
+ */
+void serial_tap_stream_stop(void);
+
+/*
+ * Reads the capture counters.
+ */
+void serial_tap_get_stats(struct serial_tap_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ARD_SERIAL_TAP_H__
@@ -14,9 +14,44 @@
 extern "C" {
 #endif
 
-// Initialize the usb_uart library.
+// Initialize the usb_uart library. Relays every pair declared
+// in devicetree, or the CONFIG_PASSTHROUGH_* pair if none are.
 void usb_uart_init(void);
 
+// Latency vs throughput tuning for all pairs. Received data that
+// hasn't been forwarded is sent once the line has been idle for
+// idle_us microseconds (0 disables the timeout). Data is forwarded
+// without waiting once threshold bytes have collected.
+void usb_uart_set_flush(uint32_t idle_us, uint32_t threshold);
+
+// Flow control counters of one pair. The UART is throttled when
+// the USB side falls behind. The USB host can't be held off, so
+// data from the host that the UART can't keep up with is dropped.
+struct usb_uart_stats {
+	uint32_t uart_throttled;    // Times the UART was throttled
+	uint32_t usb_dropped;       // Bytes from the host dropped
+};
+
+// Reads the counters of pair (the index in devicetree order).
+// Returns 0 or -EINVAL.
+int usb_uart_get_stats(int pair, struct usb_uart_stats *stats);
+
+// Modem trace relay counters (CONFIG_USB_UART_TRACE).
+struct usb_uart_trace_stats {
+	uint32_t bytes;     // Bytes received from the 9160
+	uint32_t dropped;   // Bytes lost because the ring was full
+	uint32_t overruns;  // UART overruns
+	uint32_t errors;    // Other UART receive errors
+	uint32_t max_fill;  // Highest ring fill seen
+};
+
+// Starts relaying modem trace from the 9160. Called by
+// usb_uart_init() when CONFIG_USB_UART_TRACE is set.
+int usb_uart_trace_init(void);
+
+// Reads the modem trace relay counters.
+void usb_uart_trace_get_stats(struct usb_uart_trace_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -14,6 +14,7 @@
  */ 
 
 #include <ardesco.h>
+#include <string.h>
 
 #include <device.h>
 #include <drivers/uart.h>
@@ -22,6 +23,7 @@
 #include <usb/usb_device.h>
 
 #include <serial_52lib.h>
+#include <serial_tap.h>
 
 // The app-visible defines.
 #include <ipc_communication.h>
@@ -56,6 +58,9 @@ static struct ipc_serial_dev {
 	struct k_fifo *rx_fifo;
 	struct k_fifo *tx_fifo;
 	struct uart_data *rx;
+	// Buffer being sent and how much of it has been sent.
+	struct uart_data *tx;
+	uint16_t tx_written;
 } ipcdevs[2];
 
 #if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
@@ -127,6 +132,8 @@ static void ipc_interrupt_handler(void *user_data)
 				(sd->rx->buffer[sd->rx->len - 1] == '\r') ||
 				(sd->rx->buffer[sd->rx->len - 1] == '\0')) 
 				{
+					serial_tap_record(SERIAL_TAP_PORT_IPC, SERIAL_TAP_DIR_FROM_9160,
+					                  sd->rx->buffer, sd->rx->len);
 					k_fifo_put(sd->rx_fifo, sd->rx);
 					sd->rx = NULL;
 				}
@@ -136,31 +143,28 @@ static void ipc_interrupt_handler(void *user_data)
 
 	if (uart_irq_tx_ready(dev)) 
 	{
-		struct uart_data *buf = k_fifo_get(sd->tx_fifo, K_NO_WAIT);
-		uint16_t written = 0;
+		// Resume the buffer in progress or start the next one.
+		if (!sd->tx) {
+			sd->tx = k_fifo_get(sd->tx_fifo, K_NO_WAIT);
+			sd->tx_written = 0;
+		}
 
 		/* Nothing in the FIFO, nothing to send */
-		if (!buf) {
+		if (!sd->tx) {
 			uart_irq_tx_disable(dev);
 			return;
 		}
 
-		while (buf->len > written) {
-			written += uart_fifo_fill(dev,
-						  &buf->buffer[written],
-						  buf->len - written);
-		}
+		// Don't spin waiting for the data to shift out. The next
+		// tx ready interrupt continues where this one stopped.
+		sd->tx_written += uart_fifo_fill(dev,
+						 &sd->tx->buffer[sd->tx_written],
+						 sd->tx->len - sd->tx_written);
 
-		while (!uart_irq_tx_complete(dev)) {
-			/* Wait for the last byte to get
-			 * shifted out of the module
-			 */
-		}
-
-		if (k_fifo_is_empty(sd->tx_fifo)) {
-			uart_irq_tx_disable(dev);
+		if (sd->tx_written >= sd->tx->len) {
+			k_free(sd->tx);
+			sd->tx = NULL;
 		}
-		k_free(buf);
 	}
 }
 
@@ -172,6 +176,8 @@ int ipc_lowlevel_sendstring (char *str)
 	//printk ("coproc_sendstring++\n");
 	if (uart_ipc_dev == 0)
 		return -1;
+	serial_tap_record(SERIAL_TAP_PORT_IPC, SERIAL_TAP_DIR_TO_9160,
+	                  (uint8_t *)str, strlen(str));
 	while (!fStopComms && (*str != '\0'))  
 	{
 		uart_poll_out(uart_ipc_dev, *str++);
@@ -205,6 +211,7 @@ static void ipc52_monitor_thread(void *p1, void *p2, void *p3)
 	{
 		uart_ipc_sd->dev = uart_ipc_dev;
 		uart_ipc_sd->rx = 0;
+		uart_ipc_sd->tx = 0;
 		uart_ipc_sd->rx_fifo = &uart_ipc_rx_fifo;
 
 		// Now init the struct to pass to the isr handler.
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * sample_decode - Prints sample batches as CSV.
+ *
+ *   sample_decode [file]
+ *
+ * Reads one batch, with or without the CBOR envelope, from the file
+ * or stdin and prints a line of timestamp and values per sample. A
+ * "0x" hex string as printed by the using_sensors app is also taken.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "sample_codec.h"
+
+#define MAX_BATCH   65536
+
+static uint8_t buf[MAX_BATCH];
+
+/*
+ * from_hex - Converts a hex dump in place. Returns the bytes, or the
+ * input length if it isn't one.
+ */
+static size_t from_hex(uint8_t *p, size_t len)
+{
+    size_t i, n = 0;
+
+    if ((len < 2) || (p[0] != '0') || (tolower(p[1]) != 'x'))
+        return len;
+    for (i = 2; i + 1 < len; i += 2)
+    {
+        char hex[3] = { p[i], p[i + 1], 0 };
+
+        if (!isxdigit(p[i]) || !isxdigit(p[i + 1]))
+            break;
+        p[n++] = (uint8_t)strtoul(hex, 0, 16);
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f = stdin;
+    struct sample_dec d;
+    int32_t val[SAMPLE_CODEC_MAX_CHANNELS];
+    uint32_t ts;
+    size_t len;
+    int rc;
+
+    if ((argc > 1) && ((f = fopen(argv[1], "rb")) == 0))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    len = fread(buf, 1, sizeof (buf), f);
+    if (f != stdin)
+        fclose(f);
+
+    len = from_hex(buf, len);
+    if (sample_dec_init(&d, buf, len) < 0)
+    {
+        fprintf(stderr, "Not a sample batch\n");
+        return 1;
+    }
+    printf("# schema %u, %u channels\n", d.schema_id, d.channels);
+    while ((rc = sample_dec_next(&d, &ts, val)) > 0)
+    {
+        printf("%u", ts);
+        for (int i = 0; i < d.channels; i++)
+            printf(",%d", val[i]);
+        printf("\n");
+    }
+    if (rc < 0)
+    {
+        fprintf(stderr, "Batch corrupt after %u samples\n", d.count);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * sample_roundtrip - Encodes batches and checks they decode to the
+ * same samples.
+ *
+ *   make check
+ *
+ * Covers the bare batch and the CBOR envelope, negative deltas and
+ * values at the ends of the int32_t range, timestamps that wrap past
+ * 2^32, more than 65535 samples in one batch, and a full buffer.
+ * Prints a line per failed case and exits with 1 if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "sample_codec.h"
+
+#define MAX_SAMPLES     70000
+#define MAX_BATCH       (MAX_SAMPLES * SAMPLE_CODEC_MAX_RECORD)
+
+struct sample {
+    uint32_t ts;
+    int32_t val[SAMPLE_CODEC_MAX_CHANNELS];
+};
+
+static uint8_t buf[MAX_BATCH];
+static struct sample in[MAX_SAMPLES];
+static int failures;
+
+/*
+ * fail - Reports a failed case.
+ */
+static void fail(const char *name, const char *what)
+{
+    printf("FAIL %s: %s\n", name, what);
+    failures++;
+}
+
+/*
+ * roundtrip - Encodes n samples of channels values into size bytes,
+ * decodes them and compares. Samples that don't fit are left out, as
+ * the encoder leaves them out, and want is how many must fit.
+ */
+static void roundtrip(const char *name, uint8_t channels, int n, size_t size,
+                      uint32_t schema_id, uint32_t flags, int want)
+{
+    struct sample_enc e;
+    struct sample_dec d;
+    struct sample out;
+    int added = 0;
+    int len, rc, i;
+
+    if (sample_enc_init(&e, buf, size, channels) < 0)
+    {
+        fail(name, "init");
+        return;
+    }
+    for (i = 0; i < n; i++)
+    {
+        rc = sample_enc_add(&e, in[i].ts, in[i].val);
+        if (rc == -ENOSPC)
+            break;
+        if (rc < 0)
+        {
+            fail(name, "add");
+            return;
+        }
+        added++;
+    }
+    if (added != want)
+    {
+        fail(name, "samples added");
+        return;
+    }
+    if (e.count != (uint32_t)added)
+        fail(name, "encoder count");
+    if ((len = sample_enc_finish(&e, schema_id, flags)) < 0)
+    {
+        fail(name, "finish");
+        return;
+    }
+
+    if (sample_dec_init(&d, buf, len) < 0)
+    {
+        fail(name, "decode init");
+        return;
+    }
+    if ((d.schema_id != ((flags & SAMPLE_CODEC_CBOR) ? schema_id : 0)) || (d.channels != channels))
+        fail(name, "header");
+    for (i = 0; (rc = sample_dec_next(&d, &out.ts, out.val)) > 0; i++)
+    {
+        if ((i >= added) || (out.ts != in[i].ts) ||
+            memcmp (out.val, in[i].val, channels * sizeof (int32_t)))
+        {
+            printf("FAIL %s: sample %d\n", name, i);
+            failures++;
+            return;
+        }
+    }
+    if (rc < 0)
+        fail(name, "corrupt");
+    else if ((i != added) || (d.count != (uint32_t)added))
+        fail(name, "decoded count");
+}
+
+int main(void)
+{
+    static const int32_t ends[] = { INT32_MIN, INT32_MAX, -1, 0, INT32_MAX, INT32_MIN };
+    int n = sizeof (ends) / sizeof (ends[0]);
+    int i;
+
+    // Steady period, values going down as well as up.
+    for (i = 0; i < 100; i++)
+    {
+        in[i].ts = 1000 + i * 10;
+        in[i].val[0] = 500 - i * 7;
+        in[i].val[1] = (i & 1) ? -i : i;
+        in[i].val[2] = -20000 + (i % 13) * 3;
+    }
+    roundtrip("bare", 3, 100, sizeof (buf), 0, 0, 100);
+    roundtrip("cbor", 3, 100, sizeof (buf), 0x12345, SAMPLE_CODEC_CBOR, 100);
+    roundtrip("cbor_small_id", 3, 100, sizeof (buf), 7, SAMPLE_CODEC_CBOR, 100);
+
+    // Jumps across the whole int32_t range, and periods that shrink.
+    for (i = 0; i < n; i++)
+    {
+        in[i].ts = 5000 - (n - i) * (n - i);
+        for (int c = 0; c < SAMPLE_CODEC_MAX_CHANNELS; c++)
+            in[i].val[c] = ends[(i + c) % n];
+    }
+    roundtrip("int32_ends", SAMPLE_CODEC_MAX_CHANNELS, n, sizeof (buf), 1, SAMPLE_CODEC_CBOR, n);
+
+    // Timestamps wrapping past 2^32.
+    for (i = 0; i < 50; i++)
+    {
+        in[i].ts = 0xffffff00u + (uint32_t)i * 20;
+        in[i].val[0] = -i;
+    }
+    roundtrip("ts_wrap", 1, 50, sizeof (buf), 0, 0, 50);
+
+    // More samples than a uint16_t counts, with a period change after
+    // 65536 so a wrapped count would lose it.
+    for (i = 0; i < MAX_SAMPLES; i++)
+    {
+        in[i].ts = (i <= 65536) ? i * 2 : 65536 * 2 + (i - 65536) * 3;
+        in[i].val[0] = i % 100 - 50;
+    }
+    roundtrip("many", 1, MAX_SAMPLES, sizeof (buf), 0, 0, MAX_SAMPLES);
+
+    // A full buffer keeps the samples that fit. The header and each
+    // of these samples take 2 bytes, and the odd byte left over can't
+    // hold the 11th.
+    roundtrip("full", 1, 100, 2 + 2 * 10 + 1, 0, 0, 10);
+
+    printf("%s, %d failed\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * Sample batch encoder and decoder. See sample_codec.h for the format.
+ *
+ * Only the C library is used, so the same file builds into the
+ * device image and the Linux decoder in host/.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "sample_codec.h"
+
+// CBOR major types
+#define CBOR_UINT       0
+#define CBOR_BSTR       2
+#define CBOR_ARRAY      4
+
+// Longest CBOR envelope: array head, uint32 and bstr head
+#define CBOR_ENVELOPE_MAX   11
+
+//----------------------------------------------------
+// zigzag - Maps signed to unsigned so small magnitudes stay small.
+//----------------------------------------------------
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+//----------------------------------------------------
+// put_varint - Writes v 7 bits a byte, low first. Returns the new
+// position, or 0 if it doesn't fit.
+//----------------------------------------------------
+static size_t put_varint(uint8_t *buf, size_t pos, size_t size, uint64_t v)
+{
+    do
+    {
+        if (pos >= size)
+            return 0;
+        buf[pos++] = (uint8_t)((v & 0x7f) | ((v > 0x7f) ? 0x80 : 0));
+        v >>= 7;
+    } while (v);
+    return pos;
+}
+
+//----------------------------------------------------
+// get_varint - Reads a varint. Returns -EBADMSG if it runs past the
+// end or is longer than 64 bits.
+//----------------------------------------------------
+static int get_varint(struct sample_dec *d, uint64_t *v)
+{
+    uint64_t val = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        uint8_t b;
+
+        if (d->pos >= d->len)
+            return -EBADMSG;
+        b = d->buf[d->pos++];
+        val |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+        {
+            *v = val;
+            return 0;
+        }
+    }
+    return -EBADMSG;
+}
+
+//----------------------------------------------------
+// cbor_head - Writes a CBOR item head. Returns its length.
+//----------------------------------------------------
+static size_t cbor_head(uint8_t *buf, uint8_t major, uint32_t arg)
+{
+    major <<= 5;
+    if (arg < 24)
+    {
+        buf[0] = major | arg;
+        return 1;
+    }
+    if (arg <= 0xff)
+    {
+        buf[0] = major | 24;
+        buf[1] = arg;
+        return 2;
+    }
+    if (arg <= 0xffff)
+    {
+        buf[0] = major | 25;
+        buf[1] = arg >> 8;
+        buf[2] = arg;
+        return 3;
+    }
+    buf[0] = major | 26;
+    buf[1] = arg >> 24;
+    buf[2] = arg >> 16;
+    buf[3] = arg >> 8;
+    buf[4] = arg;
+    return 5;
+}
+
+//----------------------------------------------------
+// cbor_get_head - Reads a CBOR item head of the given major type
+// with an argument of up to 32 bits.
+//----------------------------------------------------
+static int cbor_get_head(const uint8_t *buf, size_t len, size_t *pos, uint8_t major, uint32_t *arg)
+{
+    uint8_t ai;
+    int n;
+
+    if ((*pos >= len) || ((buf[*pos] >> 5) != major))
+        return -EBADMSG;
+    ai = buf[(*pos)++] & 0x1f;
+    if (ai < 24)
+    {
+        *arg = ai;
+        return 0;
+    }
+    if (ai > 26)
+        return -EBADMSG;
+    n = 1 << (ai - 24);
+    if (*pos + n > len)
+        return -EBADMSG;
+    for (*arg = 0; n; n--)
+        *arg = (*arg << 8) | buf[(*pos)++];
+    return 0;
+}
+
+/*
+ * sample_enc_init - Starts a batch.
+ */
+int sample_enc_init(struct sample_enc *e, uint8_t *buf, size_t size, uint8_t channels)
+{
+    if ((channels == 0) || (channels > SAMPLE_CODEC_MAX_CHANNELS))
+        return -EINVAL;
+
+    memset (e, 0, sizeof (struct sample_enc));
+    e->buf = buf;
+    e->size = size;
+    e->channels = channels;
+    if (size < 2)
+        return -ENOSPC;
+    buf[0] = SAMPLE_CODEC_VERSION;
+    e->len = put_varint(buf, 1, size, channels);
+    return 0;
+}
+
+/*
+ * sample_enc_add - Adds a sample.
+ */
+int sample_enc_add(struct sample_enc *e, uint32_t timestamp, const int32_t *val)
+{
+    int64_t dt = (uint32_t)(timestamp - e->last_ts);
+    size_t pos;
+
+    pos = put_varint(e->buf, e->len, e->size, zigzag(dt - e->last_dt));
+    for (int i = 0; (i < e->channels) && pos; i++)
+        pos = put_varint(e->buf, pos, e->size, zigzag((int64_t)val[i] - e->last[i]));
+    if (pos == 0)
+        return -ENOSPC;
+
+    // The first timestamp is absolute, so it isn't a period.
+    e->last_dt = e->count ? dt : 0;
+    e->last_ts = timestamp;
+    memcpy (e->last, val, e->channels * sizeof (int32_t));
+    e->len = pos;
+    e->count++;
+    return 0;
+}
+
+/*
+ * sample_enc_finish - Ends the batch, adding the envelope if asked.
+ */
+int sample_enc_finish(struct sample_enc *e, uint32_t schema_id, uint32_t flags)
+{
+    uint8_t head[CBOR_ENVELOPE_MAX];
+    size_t n;
+
+    if ((flags & SAMPLE_CODEC_CBOR) == 0)
+        return e->len;
+
+    n = cbor_head(head, CBOR_ARRAY, 2);
+    n += cbor_head(head + n, CBOR_UINT, schema_id);
+    n += cbor_head(head + n, CBOR_BSTR, e->len);
+    if (e->len + n > e->size)
+        return -ENOSPC;
+    memmove (e->buf + n, e->buf, e->len);
+    memcpy (e->buf, head, n);
+    e->len += n;
+    return e->len;
+}
+
+/*
+ * sample_dec_init - Starts decoding a batch.
+ */
+int sample_dec_init(struct sample_dec *d, const uint8_t *buf, size_t len)
+{
+    uint64_t channels;
+    uint32_t arg;
+    size_t pos = 0;
+
+    memset (d, 0, sizeof (struct sample_dec));
+
+    // An envelope starts with an array head, a bare batch with the
+    // version.
+    if ((len > 0) && ((buf[0] >> 5) == CBOR_ARRAY))
+    {
+        if ((cbor_get_head(buf, len, &pos, CBOR_ARRAY, &arg) < 0) || (arg != 2) ||
+            (cbor_get_head(buf, len, &pos, CBOR_UINT, &d->schema_id) < 0) ||
+            (cbor_get_head(buf, len, &pos, CBOR_BSTR, &arg) < 0) || (arg > len - pos))
+            return -EBADMSG;
+        len = arg;
+    }
+    d->buf = buf + pos;
+    d->len = len;
+
+    if ((d->len < 2) || (d->buf[0] != SAMPLE_CODEC_VERSION))
+        return -EBADMSG;
+    d->pos = 1;
+    if ((get_varint(d, &channels) < 0) || (channels == 0) || (channels > SAMPLE_CODEC_MAX_CHANNELS))
+        return -EBADMSG;
+    d->channels = channels;
+    return 0;
+}
+
+/*
+ * sample_dec_next - Decodes the next sample.
+ */
+int sample_dec_next(struct sample_dec *d, uint32_t *timestamp, int32_t *val)
+{
+    int32_t v[SAMPLE_CODEC_MAX_CHANNELS];
+    uint64_t u;
+    int64_t dt;
+
+    if (d->pos == d->len)
+        return 0;
+
+    if (get_varint(d, &u) < 0)
+        return -EBADMSG;
+    dt = d->last_dt + unzigzag(u);
+    for (int i = 0; i < d->channels; i++)
+    {
+        if (get_varint(d, &u) < 0)
+            return -EBADMSG;
+        v[i] = (int32_t)(d->last[i] + unzigzag(u));
+    }
+
+    d->last_ts += (uint32_t)dt;
+    d->last_dt = d->count ? dt : 0;
+    memcpy (d->last, v, d->channels * sizeof (int32_t));
+    d->count++;
+
+    *timestamp = d->last_ts;
+    memcpy (val, v, d->channels * sizeof (int32_t));
+    return 1;
+}
@@ -38,8 +38,7 @@
             SENSOR_CHAN_ACCEL_Z     \
         }
 
-int accl_channels[] = ACCEL_CHANNELS;
-struct sensor_value accl_raw_data[ARRAY_SIZE(accl_channels)];
+static int accl_channels[] = ACCEL_CHANNELS;
 
 LOG_MODULE_REGISTER(accel, CONFIG_APP_LOG_LEVEL);
 
@@ -59,13 +58,21 @@ void *ardaccel_init(int *prc, char *driver_name)
 {
     int rc = -1;
     struct senlib *lib = NULL;
-    //char device_name[] = ACCEL_DEV_NAME;
+    struct senlib_reg_entry *entry;
+
+    // Each instance reads into its own registry entry.
+    entry = senlib_reg_open(driver_name, SENLIB_REG_ACCEL, prc);
+    if (entry == 0)
+    {
+        LOG_ERR("Unable to open accelerometer %s", driver_name);
+        return 0;
+    }
 
     struct senlib_sensor sensor = {
-        .dev_name = driver_name,
+        .dev_name = (char *)entry->label,
         .channels = accl_channels,
         .no_of_channels = ARRAY_SIZE(accl_channels),
-        .raw_data = accl_raw_data
+        .raw_data = entry->raw
     };
 
     struct sensor_trigger sensor_trig = {
@@ -76,12 +83,15 @@ void *ardaccel_init(int *prc, char *driver_name)
     if (lib == 0)
     {
         LOG_ERR("Unable to initialize accelerometer");
+        senlib_reg_close(entry);
         return 0;
     }
 
     rc = senlib_settrigger (lib, &sensor_trig, sensor_trigger_handler, 0);
     if (rc) {
         LOG_ERR("Unable to set accelerometer trigger");
+        senlib_deinit(lib);
+        senlib_reg_close(entry);
         *prc = rc;
         return 0;
     }
@@ -95,17 +105,94 @@ void *ardaccel_init(int *prc, char *driver_name)
 int ardaccel_deinit(void *h)
 {
     struct senlib *lib = (struct senlib *)h;
+    struct senlib_reg_entry *entry;
     
     if (lib == 0)
     {
             LOG_ERR("Invalid handle in %s\n", __FUNCTION__);
             return EINVAL;
     }
+    entry = CONTAINER_OF(senlib_getsensor(lib)->raw_data, struct senlib_reg_entry, raw);
     senlib_deinit(lib);
+    senlib_reg_close(entry);
+
+    return 0;
+}
 
+//====================================================
+// ardaccel_read_i32 - Read data in mm/s^2.
+//====================================================
+int ardaccel_read_i32 (void *h, accel_data_i32_t *pData)
+{
+    int data_size;
+
+    if ((h == 0) || (pData == 0))
+	{
+		LOG_ERR("Invalid handle in %s\n", __FUNCTION__);
+		return -EINVAL;
+	}
+    data_size = senlib_readsensor_milli(h, (int32_t *)pData, sizeof(accel_data_i32_t));
+    if (data_size < 0)
+        return data_size;
+    return 0;
+}
+
+//====================================================
+// ardaccel_read_i32_cached - Read data in mm/s^2, or the last
+// sample if it is at most max_age_ms old.
+//====================================================
+int ardaccel_read_i32_cached (void *h, accel_data_i32_t *pData, uint32_t max_age_ms)
+{
+    int data_size;
+
+    if ((h == 0) || (pData == 0))
+	{
+		LOG_ERR("Invalid handle in %s\n", __FUNCTION__);
+		return -EINVAL;
+	}
+    data_size = senlib_readsensor_cached(h, (int32_t *)pData, sizeof(accel_data_i32_t), max_age_ms);
+    if (data_size < 0)
+        return data_size;
     return 0;
 }
 
+//====================================================
+// ardaccel_read_async - Queues a read. fn gets an accel_data_i32_t in mm/s^2.
+//====================================================
+int ardaccel_read_async (void *h, SenLib_trigger_fn fn, uint32_t userdata)
+{
+    if ((h == 0) || (fn == 0))
+	{
+		LOG_ERR("Invalid handle in %s\n", __FUNCTION__);
+		return -EINVAL;
+	}
+    return senlib_read_async(h, fn, userdata);
+}
+
+//====================================================
+// ardaccel_read_i16 - Read data in cm/s^2.
+//====================================================
+int ardaccel_read_i16 (void *h, accel_data_i16_t *pData)
+{
+    accel_data_i32_t data;
+    int rc;
+
+    if (pData == 0)
+	{
+		LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+		return -EINVAL;
+	}
+    rc = ardaccel_read_i32(h, &data);
+    if (rc == 0)
+    {
+        pData->x = senlib_milli_to_i16(data.x, 10);
+        pData->y = senlib_milli_to_i16(data.y, 10);
+        pData->z = senlib_milli_to_i16(data.z, 10);
+    }
+    return rc;
+}
+
+#ifdef CONFIG_SENLIB_DOUBLE_API
 //====================================================
 // ardaccel_read - Read data to the server.
 //====================================================
@@ -133,6 +220,7 @@ int ardaccel_read (void *h, void *pData, int nSize)
     }
     return rc;
 }
+#endif //CONFIG_SENLIB_DOUBLE_API
 
 //====================================================
 // ardaccel_configure - Configure the library.
@@ -145,16 +233,6 @@ int ardaccel_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize
     float *accuracy = pData;
     const char m_units[] = ACCEL_MU;
 	uint8_t no_of_munits = sizeof(m_units) / sizeof(m_units[0]);
-    enum accel_limits {
-        ACCEL_LOW_THRESH,
-        ACCEL_HIGH_THRESH,
-        ACCEL_THRESH_COUNT
-    };
-
-    // enum sensor_attribute accel_limits_attr[ACCEL_THRESH_COUNT] = {
-    //     [ACCEL_LOW_THRESH] = SENSOR_ATTR_LOWER_THRESH,
-    //     [ACCEL_HIGH_THRESH] = SENSOR_ATTR_UPPER_THRESH,
-    // };
 
     if ((Func != ARDCONFIG_GETVERSION) && (lib == 0))
 	{
@@ -181,10 +259,84 @@ int ardaccel_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize
                 return EINVAL;
             }
             senlib_savecb(lib, cbs->fn, cbs->userdata);
+            senlib_setreasons(lib, cbs->reasonflags ? cbs->reasonflags : ARDCB_EN_ALL);
             break;
-        // case ARDCONFIG_SETMSRTIMER:
-        //     SensorLib_SetTimer(lib, *(s32_t *)pData);
-        //     break;
+        case ARDCONFIG_SETMSRTIMER:
+            // Sample period in ms. 0 stops periodic sampling.
+            if ((pnSize == 0) || (*pnSize != sizeof(uint32_t)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_setperiod(lib, *(uint32_t *)pData);
+            break;
+        case ARDCONFIG_GETMSRSTATS:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_period_stats)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_getperiodstats(lib, pData);
+            break;
+        case ARDCONFIG_SETSTATS:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_stats_cfg)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_setstats(lib, pData);
+            break;
+        case ARDCONFIG_GETSTATS:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_stats_result)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_getstats(lib, pData);
+            break;
+        case ARDCONFIG_GETCACHESTATS:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_cache_stats)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_getcachestats(lib, pData);
+            break;
+#ifdef CONFIG_SENLIB_FIFO
+        case ARDCONFIG_ACCEL_SETFIFO:
+            // A NULL pData stops FIFO capture.
+            if (pData == 0)
+            {
+                rc = ardaccel_fifo_stop(lib);
+                break;
+            }
+            if ((pnSize == 0) || (*pnSize != sizeof(struct accel_fifo_cfg)))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = ardaccel_fifo_start(lib, pData);
+            break;
+        case ARDCONFIG_ACCEL_SETMOTION:
+            // A NULL pData stops motion wake.
+            if (pData == 0)
+            {
+                rc = ardaccel_motion_stop(lib);
+                break;
+            }
+            if ((pnSize == 0) || (*pnSize != sizeof(struct accel_motion_cfg)))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = ardaccel_motion_start(lib, pData);
+            break;
+#else
+        case ARDCONFIG_ACCEL_SETFIFO:
+        case ARDCONFIG_ACCEL_SETMOTION:
+            rc = -ENOTSUP;
+            break;
+#endif //CONFIG_SENLIB_FIFO
         case ARDCONFIG_GETUNITS:
             for(uint8_t idx = 0; idx < no_of_munits; idx++)
             {
@@ -198,13 +350,23 @@ int ardaccel_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize
         case ARDCONFIG_GETFREQUENCY:
             //TODO
             break;
-        // case ARDCONFIG_SETLIMIT:
-        //     if(!does_sensor_contain_attr(accel_limits_attr[ACCEL_LOW_THRESH]) ||
-        //        !does_sensor_contain_attr(accel_limits_attr[ACCEL_HIGH_THRESH])  ) {
-        //         return EINVAL;
-        //     }
-        //     rc = SensorLib_SetAttributes(lib->dev, accel_limits_attr, 
-        //                 (int *)pData, ACCEL_THRESH_COUNT);
+        case ARDCONFIG_SETLIMIT:
+            // Software change detection on one channel.
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_limit_cfg)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_setlimit(lib, pData);
+            break;
+        case ARDCONFIG_GETLIMIT:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_limit_cfg)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_getlimit(lib, pData);
+            break;
         default:
             LOG_ERR("Invalid Function in %s\n", __FUNCTION__);
             rc = EINVAL;
@@ -219,15 +381,15 @@ int ardaccel_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize
 static void handle_data_callback(void *in, void *out, uint32_t *psize)
 {
     struct sensor_value *in_data = in;
-    accel_data_t *out_data = out;
+    accel_data_i32_t *out_data = out;
     enum accel_channels_order {
         ACCEL_CHAN_X,
         ACCEL_CHAN_Y,
         ACCEL_CHAN_Z
     };
 
-    out_data->x = sensor_value_to_double(&in_data[ACCEL_CHAN_X]);
-    out_data->y = sensor_value_to_double(&in_data[ACCEL_CHAN_Y]);
-    out_data->z = sensor_value_to_double(&in_data[ACCEL_CHAN_Z]);
-    *psize = sizeof(accel_data_t);
+    out_data->x = senlib_value_to_milli(&in_data[ACCEL_CHAN_X]);
+    out_data->y = senlib_value_to_milli(&in_data[ACCEL_CHAN_Y]);
+    out_data->z = senlib_value_to_milli(&in_data[ACCEL_CHAN_Z]);
+    *psize = sizeof(accel_data_i32_t);
 }
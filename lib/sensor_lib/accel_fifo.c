@@ -0,0 +1,691 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * FIFO burst mode for the ADXL362 and ADXL372.
+ *
+ * The Zephyr drivers read one XYZ sample per fetch. Here the part's
+ * own FIFO is run in stream mode with the watermark mapped to INT1.
+ * When the watermark is reached, the work handler reads the status
+ * and entry count, then drains the FIFO in one SPI transfer into the
+ * caller's array. The CPU wakes once per watermark instead of once
+ * per sample.
+ *
+ * Motion wake uses the ADXL362 activity and inactivity detection in
+ * loop mode with autosleep. The part tracks motion by itself, drops to
+ * its wake-up rate while still, and drives its AWAKE state on INT1.
+ * Each edge is one motion start or stop event, so nothing has to poll
+ * the accelerometer to know whether the device is moving.
+ *
+ * The registers are accessed directly on the SPI bus of the node in
+ * devicetree, so INT1 must not also be used by the driver's trigger
+ * (CONFIG_ADXL362_TRIGGER / CONFIG_ADXL372_TRIGGER). The FIFO and
+ * motion wake share INT1 and can't run at the same time.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+#include <logging/log.h>
+#include <drivers/spi.h>
+#include <drivers/gpio.h>
+#include "accel_sensor.h"
+
+LOG_MODULE_REGISTER(accel_fifo, CONFIG_APP_LOG_LEVEL);
+
+// Both parts hold 512 FIFO entries, 3 entries per XYZ sample.
+#define FIFO_MAX_ENTRIES     512
+#define FIFO_MAX_SAMPLES     (FIFO_MAX_ENTRIES / 3)
+
+// ADXL362 commands and registers
+#define ADXL362_WRITE_REG       0x0A
+#define ADXL362_READ_REG        0x0B
+#define ADXL362_READ_FIFO       0x0D
+#define ADXL362_STATUS          0x0B    // STATUS, FIFO_ENTRIES_L/H follow
+#define ADXL362_THRESH_ACT      0x20    // THRESH_ACT_L/H, TIME_ACT,
+                                        // THRESH_INACT_L/H, TIME_INACT_L/H,
+                                        // ACT_INACT_CTL follow
+#define ADXL362_FIFO_CONTROL    0x28
+#define ADXL362_FIFO_SAMPLES    0x29
+#define ADXL362_INTMAP1         0x2A
+#define ADXL362_FILTER_CTL      0x2C
+#define ADXL362_POWER_CTL       0x2D
+#define ADXL362_STATUS_OVERRUN  0x08
+#define ADXL362_STATUS_AWAKE    0x40
+#define ADXL362_FIFO_STREAM     0x02
+#define ADXL362_FIFO_AH         0x08    // Bit 8 of FIFO_SAMPLES
+#define ADXL362_INT_WATERMARK   0x04
+#define ADXL362_INT_AWAKE       0x40
+#define ADXL362_MEASURE         0x02
+#define ADXL362_AUTOSLEEP       0x04
+#define ADXL362_ACT_EN          0x01
+#define ADXL362_ACT_REF         0x02
+#define ADXL362_INACT_EN        0x04
+#define ADXL362_INACT_REF       0x08
+#define ADXL362_LOOP            0x30
+#define ADXL362_WAKEUP_HZ       6       // Rate while autosleep has it asleep
+
+// ADXL372 registers. The address is sent shifted left with the
+// read bit in bit 0.
+#define ADXL372_STATUS          0x04    // STATUS2, FIFO_ENTRIES2/1 follow
+#define ADXL372_FIFO_DATA       0x42
+#define ADXL372_FIFO_SAMPLES    0x39
+#define ADXL372_FIFO_CTL        0x3A
+#define ADXL372_INT1_MAP        0x3B
+#define ADXL372_TIMING          0x3D
+#define ADXL372_POWER_CTL       0x3F
+#define ADXL372_STATUS_OVERRUN  0x08
+#define ADXL372_FIFO_STREAM     0x02
+#define ADXL372_INT_FIFO_FULL   0x04
+#define ADXL372_MEASURE         0x03
+#define ADXL372_SERIES_START    0x0001
+
+enum fifo_part {
+    FIFO_ADXL362,
+    FIFO_ADXL372
+};
+
+struct fifo_dev {
+    enum fifo_part part;
+    const char *label;
+    const char *spi_label;
+    const char *cs_label;
+    const char *int_label;
+    uint16_t spi_slave;
+    uint32_t spi_freq;
+    gpio_pin_t cs_pin;
+    gpio_dt_flags_t cs_flags;
+    gpio_pin_t int_pin;
+    gpio_dt_flags_t int_flags;
+
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
+    struct device *spi;
+    struct device *gpio;
+#else
+    const struct device *spi;
+    const struct device *gpio;
+#endif
+    struct spi_config spi_cfg;
+    struct spi_cs_control cs_ctrl;
+    struct gpio_callback gpio_cb;
+    struct k_work work;
+
+    bool running;
+    uint32_t period_us;         // Sample period at the selected rate
+    struct accel_fifo_cfg cfg;
+    struct accel_fifo_stats stats;
+
+    bool motion;                // Motion wake on, owns INT1
+    bool moving;
+    struct k_work motion_work;
+    struct accel_motion_cfg mcfg;
+};
+
+#define FIFO_DEV(inst, p, compat)                                   \
+    {                                                               \
+        .part = p,                                                  \
+        .label = DT_LABEL(DT_INST(inst, compat)),                   \
+        .spi_label = DT_BUS_LABEL(DT_INST(inst, compat)),           \
+        .cs_label = DT_SPI_DEV_CS_GPIOS_LABEL(DT_INST(inst, compat)), \
+        .cs_pin = DT_SPI_DEV_CS_GPIOS_PIN(DT_INST(inst, compat)),   \
+        .cs_flags = DT_SPI_DEV_CS_GPIOS_FLAGS(DT_INST(inst, compat)), \
+        .int_label = DT_GPIO_LABEL(DT_INST(inst, compat), int1_gpios), \
+        .int_pin = DT_GPIO_PIN(DT_INST(inst, compat), int1_gpios),  \
+        .int_flags = DT_GPIO_FLAGS(DT_INST(inst, compat), int1_gpios), \
+        .spi_slave = DT_REG_ADDR(DT_INST(inst, compat)),            \
+        .spi_freq = DT_PROP(DT_INST(inst, compat), spi_max_frequency), \
+    }
+
+static struct fifo_dev fifo_devs[] = {
+#if DT_HAS_COMPAT_STATUS_OKAY(adi_adxl362)
+    FIFO_DEV(0, FIFO_ADXL362, adi_adxl362),
+#endif
+#if DT_HAS_COMPAT_STATUS_OKAY(adi_adxl372)
+    FIFO_DEV(0, FIFO_ADXL372, adi_adxl372),
+#endif
+};
+
+// Raw FIFO entries. Drains run one at a time on the sensor work queue.
+static uint8_t fifo_raw[FIFO_MAX_ENTRIES * 2];
+
+//----------------------------------------------------
+// reg_write - Writes one register.
+//----------------------------------------------------
+static int reg_write(struct fifo_dev *fd, uint8_t reg, uint8_t val)
+{
+    uint8_t cmd[3];
+    struct spi_buf buf = { .buf = cmd };
+    const struct spi_buf_set tx = { .buffers = &buf, .count = 1 };
+
+    if (fd->part == FIFO_ADXL362)
+    {
+        cmd[0] = ADXL362_WRITE_REG;
+        cmd[1] = reg;
+        cmd[2] = val;
+        buf.len = 3;
+    }
+    else
+    {
+        cmd[0] = reg << 1;
+        cmd[1] = val;
+        buf.len = 2;
+    }
+    return spi_write(fd->spi, &fd->spi_cfg, &tx);
+}
+
+//----------------------------------------------------
+// reg_read - Reads len registers starting at reg, or len bytes
+// of FIFO data when reg is the FIFO.
+//----------------------------------------------------
+static int reg_read(struct fifo_dev *fd, uint8_t reg, uint8_t *data, int len)
+{
+    uint8_t cmd[2];
+    struct spi_buf tx_buf = { .buf = cmd };
+    struct spi_buf rx_bufs[2] = {
+        { .buf = NULL },
+        { .buf = data, .len = len }
+    };
+    const struct spi_buf_set tx = { .buffers = &tx_buf, .count = 1 };
+    const struct spi_buf_set rx = { .buffers = rx_bufs, .count = 2 };
+
+    if (fd->part == FIFO_ADXL362)
+    {
+        if (reg == ADXL362_READ_FIFO)
+        {
+            cmd[0] = ADXL362_READ_FIFO;
+            tx_buf.len = 1;
+        }
+        else
+        {
+            cmd[0] = ADXL362_READ_REG;
+            cmd[1] = reg;
+            tx_buf.len = 2;
+        }
+    }
+    else
+    {
+        cmd[0] = (reg << 1) | 1;
+        tx_buf.len = 1;
+    }
+    // Skip the bytes clocked in while the command goes out.
+    rx_bufs[0].len = tx_buf.len;
+    return spi_transceive(fd->spi, &fd->spi_cfg, &tx, &rx);
+}
+
+//----------------------------------------------------
+// adxl362_mg_per_lsb - Scale at the range in FILTER_CTL.
+//----------------------------------------------------
+static uint16_t adxl362_mg_per_lsb(uint8_t filter_ctl)
+{
+    switch (filter_ctl >> 6)
+    {
+    case 0:
+        return 1;
+    case 1:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+//----------------------------------------------------
+// find_dev - Maps a sensor library handle to its FIFO device.
+//----------------------------------------------------
+static struct fifo_dev *find_dev(void *h)
+{
+    const struct senlib_sensor *sensor;
+
+    if (h == 0)
+        return 0;
+    sensor = senlib_getsensor(h);
+    for (int i = 0; i < ARRAY_SIZE(fifo_devs); i++)
+    {
+        if (strcmp(fifo_devs[i].label, sensor->dev_name) == 0)
+            return &fifo_devs[i];
+    }
+    return 0;
+}
+
+//----------------------------------------------------
+// fifo_drain - Reads everything in the FIFO into the caller's
+// array and passes it on. Returns the samples read.
+//----------------------------------------------------
+static int fifo_drain(struct fifo_dev *fd)
+{
+    struct accel_fifo_sample *out = fd->cfg.buf;
+    uint8_t st[4];
+    int entries, n, i, rc;
+    bool overrun;
+    uint32_t now;
+
+    // Status and entry count in one read
+    if (fd->part == FIFO_ADXL362)
+    {
+        rc = reg_read(fd, ADXL362_STATUS, st, 3);
+        entries = (st[1] | (st[2] << 8)) & 0x3FF;
+        overrun = st[0] & ADXL362_STATUS_OVERRUN;
+    }
+    else
+    {
+        rc = reg_read(fd, ADXL372_STATUS, st, 4);
+        entries = ((st[2] & 0x03) << 8) | st[3];
+        overrun = st[0] & ADXL372_STATUS_OVERRUN;
+    }
+    now = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+    if (rc)
+        return rc;
+    if (overrun)
+        fd->stats.overruns++;
+
+    // The count field is wider than the FIFO, so a corrupt status
+    // read could overrun fifo_raw. Then only whole samples, and no
+    // more than the caller has room for.
+    entries = MIN(entries, FIFO_MAX_ENTRIES);
+    entries -= entries % 3;
+    entries = MIN(entries, fd->cfg.buf_len * 3);
+    if (entries == 0)
+        return 0;
+
+    rc = reg_read(fd, (fd->part == FIFO_ADXL362) ? ADXL362_READ_FIFO : ADXL372_FIFO_DATA,
+                  fifo_raw, entries * 2);
+    if (rc)
+        return rc;
+
+    n = 0;
+    for (i = 0; i + 2 < entries; )
+    {
+        uint8_t *p = &fifo_raw[i * 2];
+        int16_t v[3];
+
+        if (fd->part == FIFO_ADXL362)
+        {
+            // Little endian. Bits 15:14 are the axis, 13:0 the
+            // sign extended value.
+            if ((p[1] >> 6) != 0)
+            {
+                // Not an X entry. Skip until the axes line up again.
+                fd->stats.resyncs++;
+                i++;
+                continue;
+            }
+            for (int a = 0; a < 3; a++)
+                v[a] = (int16_t)((p[a * 2] | (p[a * 2 + 1] << 8)) << 2) >> 2;
+        }
+        else
+        {
+            // Big endian, 12 bits left justified. Bit 0 marks X.
+            if ((p[1] & ADXL372_SERIES_START) == 0)
+            {
+                fd->stats.resyncs++;
+                i++;
+                continue;
+            }
+            for (int a = 0; a < 3; a++)
+                v[a] = (int16_t)((p[a * 2] << 8) | p[a * 2 + 1]) >> 4;
+        }
+        out[n].x = v[0];
+        out[n].y = v[1];
+        out[n].z = v[2];
+        n++;
+        i += 3;
+    }
+
+    // The newest sample was taken about when the FIFO was read,
+    // the rest one period apart before it.
+    for (i = 0; i < n; i++)
+        out[i].timestamp = now - (n - 1 - i) * fd->period_us;
+
+    fd->stats.samples += n;
+    fd->stats.bursts++;
+    return n;
+}
+
+//----------------------------------------------------
+// fifo_work_handler - Watermark reached. Drains on the sensor
+// work queue.
+//----------------------------------------------------
+static void fifo_work_handler(struct k_work *work)
+{
+    struct fifo_dev *fd = CONTAINER_OF(work, struct fifo_dev, work);
+    int n;
+
+    if (!fd->running)
+        return;
+
+    n = fifo_drain(fd);
+    if (fd->cfg.fn)
+    {
+        if (n > 0)
+            (fd->cfg.fn)(ARDCB_DATAREADY, fd->cfg.buf,
+                         n * sizeof (struct accel_fifo_sample), fd->cfg.userdata);
+        else if (n < 0)
+            (fd->cfg.fn)(ARDCB_LIBERROR, 0, n, fd->cfg.userdata);
+    }
+
+    // INT1 stays active while the FIFO is above the watermark, so
+    // no new edge comes if it filled again while we were reading.
+    if (fd->running && (gpio_pin_get(fd->gpio, fd->int_pin) > 0))
+        senlib_submit(&fd->work);
+}
+
+//----------------------------------------------------
+// motion_work_handler - AWAKE changed. Reads it back, so edges that
+// came too close together are seen as the state they ended in.
+//----------------------------------------------------
+static void motion_work_handler(struct k_work *work)
+{
+    struct fifo_dev *fd = CONTAINER_OF(work, struct fifo_dev, motion_work);
+    struct accel_motion_event evt;
+    uint8_t status;
+    int rc;
+
+    if (!fd->motion)
+        return;
+
+    rc = reg_read(fd, ADXL362_STATUS, &status, 1);
+    evt.timestamp = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+    if (rc)
+    {
+        if (fd->mcfg.fn)
+            (fd->mcfg.fn)(ARDCB_LIBERROR, 0, rc, fd->mcfg.userdata);
+        return;
+    }
+    evt.moving = (status & ADXL362_STATUS_AWAKE) != 0;
+    if (evt.moving == fd->moving)
+        return;
+    fd->moving = evt.moving;
+
+    // Sensors only needed while moving sleep with the device.
+    for (int i = 0; i < ACCEL_MOTION_MAX_GATED; i++)
+    {
+        if (fd->mcfg.gated[i])
+            senlib_setperiod(fd->mcfg.gated[i], evt.moving ? fd->mcfg.gated_period_ms[i] : 0);
+    }
+
+    if (fd->mcfg.fn)
+        (fd->mcfg.fn)(ARDCB_CHANGED, &evt, sizeof (evt), fd->mcfg.userdata);
+}
+
+//----------------------------------------------------
+// fifo_int_handler - INT1 edge. Runs in the GPIO ISR.
+//----------------------------------------------------
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
+static void fifo_int_handler(struct device *dev, struct gpio_callback *cb, uint32_t pins)
+#else
+static void fifo_int_handler(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
+#endif
+{
+    struct fifo_dev *fd = CONTAINER_OF(cb, struct fifo_dev, gpio_cb);
+
+    if (fd->motion)
+        senlib_submit(&fd->motion_work);
+    else
+        senlib_submit(&fd->work);
+}
+
+//----------------------------------------------------
+// fifo_setup - Binds the bus and interrupt pin the first time.
+//----------------------------------------------------
+static int fifo_setup(struct fifo_dev *fd)
+{
+    if (fd->spi)
+        return 0;
+
+    fd->spi = device_get_binding(fd->spi_label);
+    fd->gpio = device_get_binding(fd->int_label);
+    fd->cs_ctrl.gpio_dev = device_get_binding(fd->cs_label);
+    if (!fd->spi || !fd->gpio || !fd->cs_ctrl.gpio_dev)
+    {
+        fd->spi = 0;
+        return -ENODEV;
+    }
+    fd->cs_ctrl.gpio_pin = fd->cs_pin;
+#if !((NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4))
+    fd->cs_ctrl.gpio_dt_flags = fd->cs_flags;
+#endif
+    fd->spi_cfg.frequency = fd->spi_freq;
+    fd->spi_cfg.operation = SPI_WORD_SET(8) | SPI_TRANSFER_MSB | SPI_OP_MODE_MASTER;
+    fd->spi_cfg.slave = fd->spi_slave;
+    fd->spi_cfg.cs = &fd->cs_ctrl;
+
+    k_work_init(&fd->work, fifo_work_handler);
+    k_work_init(&fd->motion_work, motion_work_handler);
+    gpio_pin_configure(fd->gpio, fd->int_pin, GPIO_INPUT | fd->int_flags);
+    gpio_init_callback(&fd->gpio_cb, fifo_int_handler, BIT(fd->int_pin));
+    return gpio_add_callback(fd->gpio, &fd->gpio_cb);
+}
+
+//====================================================
+// ardaccel_fifo_start - Starts FIFO burst capture.
+//====================================================
+int ardaccel_fifo_start(void *h, struct accel_fifo_cfg *cfg)
+{
+    struct fifo_dev *fd;
+    uint16_t entries;
+    uint8_t odr, val;
+    int rc;
+
+    if ((h == 0) || (cfg == 0) || (cfg->buf == 0) || (cfg->odr_hz == 0) ||
+        (cfg->watermark == 0) || (cfg->watermark > FIFO_MAX_SAMPLES) ||
+        (cfg->buf_len < cfg->watermark))
+    {
+        LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+        return -EINVAL;
+    }
+    fd = find_dev(h);
+    if (fd == 0)
+        return -ENOTSUP;
+
+    if (fd->motion)
+        return -EBUSY;
+
+    rc = fifo_setup(fd);
+    if (rc)
+        return rc;
+
+    ardaccel_fifo_stop(h);
+    memcpy(&fd->cfg, cfg, sizeof (struct accel_fifo_cfg));
+    memset(&fd->stats, 0, sizeof (fd->stats));
+    entries = cfg->watermark * 3;
+
+    if (fd->part == FIFO_ADXL362)
+    {
+        // 12.5 Hz doubled up to 400 Hz
+        for (odr = 0; (odr < 5) && ((25 << odr) < cfg->odr_hz * 2); odr++)
+            ;
+        fd->period_us = 80000 >> odr;
+
+        rc = reg_read(fd, ADXL362_FILTER_CTL, &val, 1);
+        if (rc == 0)
+        {
+            // Range is left as the driver set it.
+            fd->cfg.mg_per_lsb = adxl362_mg_per_lsb(val);
+            rc = reg_write(fd, ADXL362_FILTER_CTL, (val & 0xF8) | odr);
+        }
+        if (rc == 0)
+            rc = reg_write(fd, ADXL362_FIFO_SAMPLES, entries & 0xFF);
+        if (rc == 0)
+            rc = reg_write(fd, ADXL362_FIFO_CONTROL, ADXL362_FIFO_STREAM |
+                           ((entries > 0xFF) ? ADXL362_FIFO_AH : 0));
+        if (rc == 0)
+            rc = reg_write(fd, ADXL362_INTMAP1, ADXL362_INT_WATERMARK);
+        if (rc == 0)
+            rc = reg_read(fd, ADXL362_POWER_CTL, &val, 1);
+        if (rc == 0)
+            rc = reg_write(fd, ADXL362_POWER_CTL, (val & 0xFC) | ADXL362_MEASURE);
+    }
+    else
+    {
+        // 400 Hz doubled up to 6400 Hz
+        for (odr = 0; (odr < 4) && ((400 << odr) < cfg->odr_hz); odr++)
+            ;
+        fd->period_us = 2500 >> odr;
+        fd->cfg.mg_per_lsb = 100;
+
+        // Settings only take while in standby.
+        rc = reg_write(fd, ADXL372_POWER_CTL, 0);
+        if (rc == 0)
+            rc = reg_read(fd, ADXL372_TIMING, &val, 1);
+        if (rc == 0)
+            rc = reg_write(fd, ADXL372_TIMING, (val & 0x1F) | (odr << 5));
+        if (rc == 0)
+            rc = reg_write(fd, ADXL372_FIFO_SAMPLES, entries & 0xFF);
+        if (rc == 0)
+            rc = reg_write(fd, ADXL372_FIFO_CTL, ADXL372_FIFO_STREAM | (entries >> 8));
+        if (rc == 0)
+            rc = reg_write(fd, ADXL372_INT1_MAP, ADXL372_INT_FIFO_FULL);
+        if (rc == 0)
+            rc = reg_write(fd, ADXL372_POWER_CTL, ADXL372_MEASURE);
+    }
+    if (rc)
+    {
+        LOG_ERR("FIFO setup of %s failed %d\n", fd->label, rc);
+        return rc;
+    }
+    cfg->mg_per_lsb = fd->cfg.mg_per_lsb;
+    cfg->odr_hz = 1000000 / fd->period_us;
+
+    fd->running = true;
+    gpio_pin_interrupt_configure(fd->gpio, fd->int_pin, GPIO_INT_EDGE_TO_ACTIVE);
+    return 0;
+}
+
+//====================================================
+// ardaccel_fifo_stop - Stops FIFO burst capture.
+//====================================================
+int ardaccel_fifo_stop(void *h)
+{
+    struct fifo_dev *fd = find_dev(h);
+
+    if (fd == 0)
+        return 0;
+    if (!fd->running)
+        return senlib_flush();
+
+    fd->running = false;
+    gpio_pin_interrupt_configure(fd->gpio, fd->int_pin, GPIO_INT_DISABLE);
+    if (fd->part == FIFO_ADXL362)
+    {
+        reg_write(fd, ADXL362_INTMAP1, 0);
+        reg_write(fd, ADXL362_FIFO_CONTROL, 0);
+    }
+    else
+    {
+        reg_write(fd, ADXL372_INT1_MAP, 0);
+        reg_write(fd, ADXL372_FIFO_CTL, 0);
+    }
+    // A drain may already be queued or running with cfg.buf. Wait
+    // for it, unless this is the work queue and it can't be waited on.
+    return senlib_flush();
+}
+
+//====================================================
+// ardaccel_fifo_get_stats - Reads the FIFO capture counters.
+//====================================================
+int ardaccel_fifo_get_stats(void *h, struct accel_fifo_stats *stats)
+{
+    struct fifo_dev *fd = find_dev(h);
+
+    if ((fd == 0) || (stats == 0))
+        return -EINVAL;
+
+    memcpy(stats, &fd->stats, sizeof (struct accel_fifo_stats));
+    return 0;
+}
+
+//====================================================
+// ardaccel_motion_start - Starts motion wake.
+//====================================================
+int ardaccel_motion_start(void *h, struct accel_motion_cfg *cfg)
+{
+    struct fifo_dev *fd;
+    uint32_t odr_hz, act, inact, time_act, time_inact;
+    uint8_t regs[7];
+    uint8_t val, ctl;
+    uint16_t mg_per_lsb;
+    int rc;
+
+    if ((h == 0) || (cfg == 0) || (cfg->act_mg == 0) || (cfg->inact_mg == 0))
+    {
+        LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+        return -EINVAL;
+    }
+    fd = find_dev(h);
+    if ((fd == 0) || (fd->part != FIFO_ADXL362))
+        return -ENOTSUP;
+    if (fd->running)
+        return -EBUSY;
+
+    rc = fifo_setup(fd);
+    if (rc)
+        return rc;
+
+    ardaccel_motion_stop(h);
+    memcpy(&fd->mcfg, cfg, sizeof (struct accel_motion_cfg));
+
+    // Thresholds are in LSB at the range the driver set, the timers
+    // in samples at its rate.
+    rc = reg_read(fd, ADXL362_FILTER_CTL, &val, 1);
+    if (rc)
+        return rc;
+    mg_per_lsb = adxl362_mg_per_lsb(val);
+    odr_hz = (25 << MIN(val & 0x07, 5)) / 2;
+    act = MIN(cfg->act_mg / mg_per_lsb, 0x7FF);
+    inact = MIN(cfg->inact_mg / mg_per_lsb, 0x7FF);
+    time_act = MIN(cfg->act_ms * odr_hz / 1000, 0xFF);
+    time_inact = MIN(cfg->inact_ms * odr_hz / 1000, 0xFFFF);
+
+    ctl = ADXL362_ACT_EN | ADXL362_INACT_EN | ADXL362_LOOP;
+    if (cfg->referenced)
+        ctl |= ADXL362_ACT_REF | ADXL362_INACT_REF;
+
+    regs[0] = act & 0xFF;
+    regs[1] = act >> 8;
+    regs[2] = time_act;
+    regs[3] = inact & 0xFF;
+    regs[4] = inact >> 8;
+    regs[5] = time_inact & 0xFF;
+    regs[6] = time_inact >> 8;
+    for (int i = 0; (i < sizeof (regs)) && (rc == 0); i++)
+        rc = reg_write(fd, ADXL362_THRESH_ACT + i, regs[i]);
+    if (rc == 0)
+        rc = reg_write(fd, ADXL362_THRESH_ACT + 7, ctl);
+    if (rc == 0)
+        rc = reg_write(fd, ADXL362_INTMAP1, ADXL362_INT_AWAKE);
+    if (rc == 0)
+        rc = reg_read(fd, ADXL362_POWER_CTL, &val, 1);
+    if (rc == 0)
+        rc = reg_write(fd, ADXL362_POWER_CTL, (val & 0xF8) | ADXL362_AUTOSLEEP | ADXL362_MEASURE);
+    if (rc)
+    {
+        LOG_ERR("Motion setup of %s failed %d\n", fd->label, rc);
+        return rc;
+    }
+    LOG_DBG("Motion wake %d/%d LSB, %d/%d samples at %d Hz, asleep at %d Hz\n",
+            act, inact, time_act, time_inact, odr_hz, ADXL362_WAKEUP_HZ);
+
+    // The part starts awake. The first event is the first change.
+    fd->moving = true;
+    fd->motion = true;
+    gpio_pin_interrupt_configure(fd->gpio, fd->int_pin, GPIO_INT_EDGE_BOTH);
+    return 0;
+}
+
+//====================================================
+// ardaccel_motion_stop - Stops motion wake.
+//====================================================
+int ardaccel_motion_stop(void *h)
+{
+    struct fifo_dev *fd = find_dev(h);
+    uint8_t val;
+
+    if ((fd == 0) || !fd->motion)
+        return 0;
+
+    fd->motion = false;
+    gpio_pin_interrupt_configure(fd->gpio, fd->int_pin, GPIO_INT_DISABLE);
+    reg_write(fd, ADXL362_INTMAP1, 0);
+    reg_write(fd, ADXL362_THRESH_ACT + 7, 0);
+    if (reg_read(fd, ADXL362_POWER_CTL, &val, 1) == 0)
+        reg_write(fd, ADXL362_POWER_CTL, val & ~ADXL362_AUTOSLEEP);
+    return 0;
+}
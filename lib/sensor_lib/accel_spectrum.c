@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * Vibration spectrum of the ADXL362 and ADXL372.
+ *
+ * Runs the FIFO in burst mode and feeds one axis, or the length of
+ * the XYZ vector, to the spectrum analysis in sensor_spectrum.c. Only
+ * the feature vectors reach the caller.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+#include <math.h>
+#include <logging/log.h>
+#include "accel_sensor.h"
+
+LOG_MODULE_REGISTER(accel_spectrum, CONFIG_APP_LOG_LEVEL);
+
+// One per accelerometer
+#define SPECTRUM_SLOTS          2
+#define SPECTRUM_WATERMARK      128
+
+struct spectrum_slot {
+    void *h;
+    uint8_t axis;
+    struct senlib_spectrum *sp;
+    struct accel_fifo_sample *buf;
+    int16_t *val;
+};
+
+static struct spectrum_slot slots[SPECTRUM_SLOTS];
+
+//----------------------------------------------------
+// find_slot - Slot of handle h, or a free one if h is 0.
+//----------------------------------------------------
+static struct spectrum_slot *find_slot(void *h)
+{
+    for (int i = 0; i < SPECTRUM_SLOTS; i++)
+    {
+        if (slots[i].h == h)
+            return &slots[i];
+    }
+    return 0;
+}
+
+//----------------------------------------------------
+// slot_free - Releases a slot's memory.
+//----------------------------------------------------
+static void slot_free(struct spectrum_slot *s)
+{
+    if (s->sp)
+        senlib_spectrum_free (s->sp);
+    if (s->buf)
+        ard_free (s->buf);
+    memset (s, 0, sizeof (struct spectrum_slot));
+}
+
+//----------------------------------------------------
+// spectrum_fifo_cb - FIFO burst. Runs on the sensor work queue.
+//----------------------------------------------------
+static void spectrum_fifo_cb(uint32_t reason, void *data, int len, uint32_t userdata)
+{
+    struct spectrum_slot *s = &slots[userdata];
+    struct accel_fifo_sample *in = data;
+    int n = len / sizeof (struct accel_fifo_sample);
+
+    if ((s->sp == 0) || (reason != ARDCB_DATAREADY) || (n <= 0))
+        return;
+
+    for (int i = 0; i < n; i++)
+    {
+        switch (s->axis)
+        {
+        case ACCEL_AXIS_X:
+            s->val[i] = in[i].x;
+            break;
+        case ACCEL_AXIS_Y:
+            s->val[i] = in[i].y;
+            break;
+        case ACCEL_AXIS_Z:
+            s->val[i] = in[i].z;
+            break;
+        default:
+            s->val[i] = (int16_t)lroundf(sqrtf((float)in[i].x * in[i].x +
+                                               (float)in[i].y * in[i].y +
+                                               (float)in[i].z * in[i].z));
+            break;
+        }
+    }
+    senlib_spectrum_add (s->sp, s->val, n, in[n - 1].timestamp);
+}
+
+//====================================================
+// ardaccel_spectrum_start - Starts vibration spectrum analysis.
+//====================================================
+int ardaccel_spectrum_start(void *h, struct accel_spectrum_cfg *cfg)
+{
+    struct accel_fifo_cfg fifo;
+    struct spectrum_slot *s;
+    uint16_t watermark;
+    int rc;
+
+    if ((h == 0) || (cfg == 0) || (cfg->axis > ACCEL_AXIS_MAG) || (cfg->spectrum.fn == 0))
+    {
+        LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+        return -EINVAL;
+    }
+
+    ardaccel_spectrum_stop(h);
+    s = find_slot(0);
+    if (s == 0)
+        return -ENOMEM;
+
+    watermark = cfg->watermark ? cfg->watermark : MIN(cfg->spectrum.fft_len, SPECTRUM_WATERMARK);
+
+    // The part picks the rate, so start the FIFO first. Bursts are
+    // dropped until the analysis is set up.
+    memset (&fifo, 0, sizeof (fifo));
+    fifo.odr_hz = cfg->odr_hz;
+    fifo.watermark = watermark;
+    fifo.buf_len = watermark;
+    fifo.fn = spectrum_fifo_cb;
+    fifo.userdata = s - slots;
+    s->h = h;
+    s->axis = cfg->axis;
+    s->buf = ard_malloc (watermark * (sizeof (struct accel_fifo_sample) + sizeof (int16_t)));
+    if (s->buf == 0)
+    {
+        slot_free(s);
+        return -ENOMEM;
+    }
+    s->val = (int16_t *)(s->buf + watermark);
+    fifo.buf = s->buf;
+
+    rc = ardaccel_fifo_start(h, &fifo);
+    if (rc)
+    {
+        slot_free(s);
+        return rc;
+    }
+
+    cfg->odr_hz = fifo.odr_hz;
+    cfg->mg_per_lsb = fifo.mg_per_lsb;
+    cfg->spectrum.fs_hz = fifo.odr_hz;
+    s->sp = senlib_spectrum_alloc (&cfg->spectrum);
+    if (s->sp == 0)
+    {
+        ardaccel_fifo_stop(h);
+        slot_free(s);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+//====================================================
+// ardaccel_spectrum_stop - Stops vibration spectrum analysis.
+//====================================================
+int ardaccel_spectrum_stop(void *h)
+{
+    struct spectrum_slot *s;
+
+    if (h == 0)
+        return -EINVAL;
+    s = find_slot(h);
+    if (s == 0)
+        return 0;
+
+    // The burst callback runs on the sensor work queue. It must be
+    // done with the buffers before they are freed.
+    if (ardaccel_fifo_stop(h) == -EDEADLK)
+        return -EDEADLK;
+    slot_free(s);
+    return 0;
+}
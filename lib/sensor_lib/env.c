@@ -12,7 +12,7 @@
 #define ENVLIB_VERSION_MAJOR      0
 #define ENVLIB_VERSION_MINOR      1
 
-// Sensor driver name
+// Sensor driver name when there is none in the devicetree
 #define ENV_DEV_NAME    "BME680"
 #define ENV_MU	{	\
             "C", 	\
@@ -37,8 +37,7 @@ static void handle_data_callback(void *in, void *out, uint32_t *psize);
             SENSOR_CHAN_PRESS     	\
         }
 
-int env_channels[] = ENV_CHANNELS;
-struct sensor_value env_raw_data[ARRAY_SIZE(env_channels)];
+static int env_channels[] = ENV_CHANNELS;
 
 //====================================================
 // ardenv_init - Initializes the library
@@ -46,16 +45,31 @@ struct sensor_value env_raw_data[ARRAY_SIZE(env_channels)];
 void *ardenv_init(int *prc)
 {
     struct senlib *lib = NULL;
-    char device_name[] = ENV_DEV_NAME;
+    struct senlib_reg_entry *entry;
+    const char *label = ENV_DEV_NAME;
+    int id;
+
+    // The first environment sensor in the devicetree that isn't open
+    for (id = senlib_reg_next(-1, SENLIB_REG_ENV); id >= 0; id = senlib_reg_next(id, SENLIB_REG_ENV))
+    {
+        label = senlib_reg_get(id)->label;
+        if (!senlib_reg_get(id)->open)
+            break;
+    }
+    entry = senlib_reg_open(label, SENLIB_REG_ENV, prc);
+    if (entry == 0)
+        return 0;
 
     struct senlib_sensor sensor = {
-        .dev_name = device_name,
+        .dev_name = (char *)entry->label,
         .channels = env_channels,
         .no_of_channels = ARRAY_SIZE(env_channels),
-        .raw_data = env_raw_data
+        .raw_data = entry->raw
     };
     
     lib = senlib_init(&sensor, handle_data_callback, prc);
+    if (lib == 0)
+        senlib_reg_close(entry);
     
     return lib;
 }	
@@ -66,17 +80,94 @@ void *ardenv_init(int *prc)
 int ardenv_deinit(void *h)
 {
     struct senlib *lib = (struct senlib *)h;
+    struct senlib_reg_entry *entry;
     
     if (lib == 0)
     {
             LOG_ERR("Invalid handle in %s\n", __FUNCTION__);
             return EINVAL;
     }
+    entry = CONTAINER_OF(senlib_getsensor(lib)->raw_data, struct senlib_reg_entry, raw);
     senlib_deinit(lib);
+    senlib_reg_close(entry);
+
+    return 0;
+}
+
+//====================================================
+// ardenv_read_i32 - Read data in m°C, m%RH and Pa.
+//====================================================
+int ardenv_read_i32 (void *h, env_data_i32_t *pData)
+{
+    int data_size;
 
+    if ((h == 0) || (pData == 0))
+	{
+		LOG_ERR("Invalid handle in %s\n", __FUNCTION__);
+		return -EINVAL;
+	}
+    data_size = senlib_readsensor_milli(h, (int32_t *)pData, sizeof(env_data_i32_t));
+    if (data_size < 0)
+        return data_size;
     return 0;
 }
 
+//====================================================
+// ardenv_read_i32_cached - Read data in m°C, m%RH and Pa, or the last
+// sample if it is at most max_age_ms old.
+//====================================================
+int ardenv_read_i32_cached (void *h, env_data_i32_t *pData, uint32_t max_age_ms)
+{
+    int data_size;
+
+    if ((h == 0) || (pData == 0))
+	{
+		LOG_ERR("Invalid handle in %s\n", __FUNCTION__);
+		return -EINVAL;
+	}
+    data_size = senlib_readsensor_cached(h, (int32_t *)pData, sizeof(env_data_i32_t), max_age_ms);
+    if (data_size < 0)
+        return data_size;
+    return 0;
+}
+
+//====================================================
+// ardenv_read_async - Queues a read. fn gets an env_data_i32_t in m°C, m%RH and Pa.
+//====================================================
+int ardenv_read_async (void *h, SenLib_trigger_fn fn, uint32_t userdata)
+{
+    if ((h == 0) || (fn == 0))
+	{
+		LOG_ERR("Invalid handle in %s\n", __FUNCTION__);
+		return -EINVAL;
+	}
+    return senlib_read_async(h, fn, userdata);
+}
+
+//====================================================
+// ardenv_read_i16 - Read data in 0.01 °C, 0.01 %RH and 10 Pa.
+//====================================================
+int ardenv_read_i16 (void *h, env_data_i16_t *pData)
+{
+    env_data_i32_t data;
+    int rc;
+
+    if (pData == 0)
+	{
+		LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+		return -EINVAL;
+	}
+    rc = ardenv_read_i32(h, &data);
+    if (rc == 0)
+    {
+        pData->temperature = senlib_milli_to_i16(data.temperature, 10);
+        pData->humidity = senlib_milli_to_i16(data.humidity, 10);
+        pData->pressure = senlib_milli_to_i16(data.pressure, 10);
+    }
+    return rc;
+}
+
+#ifdef CONFIG_SENLIB_DOUBLE_API
 //====================================================
 // ardenv_read - Read data to the server.
 //====================================================
@@ -106,6 +197,7 @@ int ardenv_read (void *h, void *pData, int nSize)
     }
     return rc;
 }
+#endif //CONFIG_SENLIB_DOUBLE_API
 
 //====================================================
 // ardenv_configure - Configure the library.
@@ -144,10 +236,49 @@ int ardenv_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize)
                 return EINVAL;
             }
             senlib_savecb (lib, cbs->fn, cbs->userdata);
+            senlib_setreasons (lib, cbs->reasonflags ? cbs->reasonflags : ARDCB_EN_ALL);
+            break;
+        case ARDCONFIG_SETMSRTIMER:
+            // Sample period in ms. 0 stops periodic sampling.
+            if ((pnSize == 0) || (*pnSize != sizeof(uint32_t)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_setperiod(lib, *(uint32_t *)pData);
+            break;
+        case ARDCONFIG_GETMSRSTATS:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_period_stats)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_getperiodstats(lib, pData);
+            break;
+        case ARDCONFIG_SETSTATS:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_stats_cfg)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_setstats(lib, pData);
+            break;
+        case ARDCONFIG_GETSTATS:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_stats_result)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_getstats(lib, pData);
+            break;
+        case ARDCONFIG_GETCACHESTATS:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_cache_stats)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_getcachestats(lib, pData);
             break;
-        // case ARDCONFIG_SETMSRTIMER:
-        //     SensorLib_SetTimer(lib->dev, *(s32_t *)pData);
-        //     break;
         case ARDCONFIG_GETUNITS:
             for(uint8_t idx = 0; idx < no_of_channels; idx++)
             {
@@ -158,9 +289,24 @@ int ardenv_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize)
         case ARDCONFIG_GETACCURACY:
             *accuracy = ENV_ACCURACY;
             break;
-        case ARDCONFIG_GETFREQUENCY:
-            //TODO
         case ARDCONFIG_SETLIMIT:
+            // Software change detection on one channel.
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_limit_cfg)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_setlimit(lib, pData);
+            break;
+        case ARDCONFIG_GETLIMIT:
+            if ((pnSize == 0) || (*pnSize != sizeof(struct senlib_limit_cfg)) || (pData == 0))
+            {
+                LOG_ERR("Invalid parameter in %s\n", __FUNCTION__);
+                return EINVAL;
+            }
+            rc = senlib_getlimit(lib, pData);
+            break;
+        case ARDCONFIG_GETFREQUENCY:
             //TODO
         default:
             LOG_ERR("Invalid Function in %s\n", __FUNCTION__);
@@ -176,14 +322,14 @@ int ardenv_configure(void *h, unsigned int Func, void *pData, uint32_t *pnSize)
 static void handle_data_callback(void *in, void *out, uint32_t *psize)
 {
     struct sensor_value *in_data = in;
-    env_data_t *out_data = out;
+    env_data_i32_t *out_data = out;
     enum accel_channels_order {
         TEMPERATURE,
         HUMIDITY,
         PRESSURE
     };
-    out_data->temperature = sensor_value_to_double(&in_data[TEMPERATURE]);
-    out_data->humidity = sensor_value_to_double(&in_data[HUMIDITY]);
-    out_data->pressure = sensor_value_to_double(&in_data[PRESSURE]);
-    *psize = sizeof(env_data_t);
+    out_data->temperature = senlib_value_to_milli(&in_data[TEMPERATURE]);
+    out_data->humidity = senlib_value_to_milli(&in_data[HUMIDITY]);
+    out_data->pressure = senlib_value_to_milli(&in_data[PRESSURE]);
+    *psize = sizeof(env_data_i32_t);
 }
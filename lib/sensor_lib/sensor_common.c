@@ -5,28 +5,137 @@
 #include <ardesco.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/atomic.h>
 
 #include "sensor_common.h"
+#include "sensor_stats.h"
+#include "sensor_limit.h"
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_WORKQ_STACK_SIZE
+#define CONFIG_SENLIB_WORKQ_STACK_SIZE 2048
+#endif //CONFIG_SENLIB_WORKQ_STACK_SIZE
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_WORKQ_PRIORITY
+#define CONFIG_SENLIB_WORKQ_PRIORITY 5
+#endif //CONFIG_SENLIB_WORKQ_PRIORITY
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_MAX_INSTANCES
+#define CONFIG_SENLIB_MAX_INSTANCES 6
+#endif //CONFIG_SENLIB_MAX_INSTANCES
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_ASYNC_DEPTH
+#define CONFIG_SENLIB_ASYNC_DEPTH 8
+#endif //CONFIG_SENLIB_ASYNC_DEPTH
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_ASYNC_THREADS
+#define CONFIG_SENLIB_ASYNC_THREADS 2
+#endif //CONFIG_SENLIB_ASYNC_THREADS
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_ASYNC_STACK_SIZE
+#define CONFIG_SENLIB_ASYNC_STACK_SIZE 1536
+#endif //CONFIG_SENLIB_ASYNC_STACK_SIZE
+
+// Work queue the sensors are sampled on. Keeps sampling off the
+// system work queue so other work doesn't delay it.
+static K_THREAD_STACK_DEFINE(senlib_workq_stack, CONFIG_SENLIB_WORKQ_STACK_SIZE);
+static struct k_work_q senlib_workq;
+static bool senlib_workq_started = false;
+
+struct senlib_flush_work {
+    struct k_work work;
+    struct k_sem done;
+};
+
+/*
+ * senlib_async - One senlib_read_async request. The id handed out is
+ * the slot index with a generation above it, so a stale id can't
+ * cancel a later request that got the same slot.
+ */
+enum {
+    ASYNC_FREE = 0,
+    ASYNC_QUEUED,
+    ASYNC_READING,
+    ASYNC_CALLING,
+    ASYNC_CANCELLED,
+};
+
+struct senlib_async {
+    struct k_work work;
+    struct senlib_struct *lib;
+    SenLib_trigger_fn fn;
+    uint32_t userdata;
+    struct k_sem *freed;            // Given when the slot is freed
+    uint16_t gen;
+    uint8_t state;
+    uint8_t queue;
+};
+
+// Asynchronous reads have their own queues, so a slow conversion
+// doesn't hold up periodic sampling, and reads of different sensors
+// overlap.
+static K_THREAD_STACK_ARRAY_DEFINE(async_stacks, CONFIG_SENLIB_ASYNC_THREADS,
+                                   CONFIG_SENLIB_ASYNC_STACK_SIZE);
+static struct k_work_q async_queues[CONFIG_SENLIB_ASYNC_THREADS];
+static bool async_queues_started = false;
+static struct senlib_async async_reqs[CONFIG_SENLIB_ASYNC_DEPTH];
+static struct k_spinlock async_lock;
 
 /*
  * senlib_struct - Structure used to support sensor instance data.
  * The strucure is defined here as it is private to is file.
  */ 
 struct senlib_struct {
-    // These first structures must be kept in order as the code
-    // depends on their placement and size    
-#ifdef USE_ID_TAG
-    uint32_t idtag;
-#endif
     struct k_work trig_work;        // Driver trigger work structure*/
     struct sensor_trigger trig;     // Trigger structure
     struct k_work timer_work;       // Timer period trigger work structure*/
+    struct k_work free_work;        // Frees the instance after its queued work
     struct k_timer trigger_timer;   // Timer associated with a timer*/
 
     bool use_periodic_measurement;  // Used to check if the timer can be started and stopped
     bool use_driver_trigger;        // Used to check if the driver trigger can be set or disabled
 
-    struct senlib_struct *pnext;
+    // Periodic sampling
+    uint32_t period_ms;
+    uint32_t period_start;          // Cycle count when the timer was started
+    uint32_t period_cnt;            // Periods since the timer was started
+    struct senlib_period_stats period_stats;
+
+    // Serializes access to the device and raw_data.
+    struct k_mutex lock;
+    // Formatted sample passed to the callback.
+    int32_t sample[SENLIB_MAX_CHANNELS];
+
+    // Last sample in milli-units and when it was read, for reads
+    // that accept a sample up to some age.
+    int32_t cache[SENLIB_MAX_CHANNELS];
+    int64_t cache_ticks;
+    bool cache_valid;
+    struct senlib_cache_stats cache_stats;
+
+    // Sample ring. Written by senlib_readsensor, read by any number
+    // of senlib_reader.
+    uint8_t *ring;
+    uint16_t ring_slots;
+    uint16_t slot_size;
+    atomic_t ring_head;             // Index of the next sample to write
+
+    // Per channel statistics, allocated when first set up.
+    struct senlib_stats *stats;
+
+    // Change detection and the events waiting to be reported.
+    struct senlib_limits *limits;
+    struct senlib_limit_event *limit_evt;
+    uint8_t limit_pending;
+
+    // ARDCB_xxx passed to fn
+    uint32_t reasons;
+
     int Flags;
 
 #if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
@@ -41,93 +150,75 @@ struct senlib_struct {
     /* User data*/
     uint32_t userdata;
     struct senlib_sensor sensor;
+
+    // Slot taken, and found by the trigger handler. Both change under
+    // libs_lock.
+    bool used;
+    bool bound;
 };
 
-// start of the list of allocated sensor structures.
-struct senlib_struct *listend = 0;
+/*
+ * senlib_slot - One sample in the sample ring. seq is odd while the
+ * slot is being written and 2 * (index + 1), modulo 2^32, once
+ * sample index is in it.
+ */
+struct senlib_slot {
+    atomic_t seq;
+    uint32_t timestamp;
+    struct sensor_value val[];
+};
 
-#define  TRIGGER_STRUCT          1
-#define  TRIGGER_WORK_STRUCT     2
-#define  TIMER_WORK_STRUCT       3
-#define  TIMER_STRUCT            4
 /*
- * get_lib_struct - locates the senlib structure based on either a pointer
- * to an internal structure within the base structure or by sequencing through
- * the list of senlib structures to find the matching device structure pointer.
- */  
-#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
-struct senlib_struct *get_lib_struct (struct device *dev, void *ptr, int type)
-#else
-struct senlib_struct *get_lib_struct (const struct device *dev, void *ptr, int type)
-#endif
+ * Instances. The table is static, so an instance needs no heap, and
+ * short, so the trigger handler can find one by its device from an
+ * ISR. Drivers call the handler with their own copy of the trigger,
+ * so the device is all there is to go on.
+ */
+static struct senlib_struct libs[CONFIG_SENLIB_MAX_INSTANCES];
+static struct k_spinlock libs_lock;
+
+/*
+ * lib_alloc - Takes a free slot, cleared. Returns 0 if all are used.
+ */
+static struct senlib_struct *lib_alloc (void)
 {
-    //printk ("get_lib_struct dev %x  ptr %x  type %d\r\n", (uint32_t)dev, (uint32_t)ptr, type);
-    uint32_t hexval = (uint32_t)ptr;
-#ifdef USE_ID_TAG
-    // back out structure tag
-    hexval -= sizeof (uint32_t);
-#endif
-    do {
-        if (type == TRIGGER_WORK_STRUCT)
-            break;
-        
-        // back out trig_work struct 
-        hexval -= sizeof (struct k_work);
-        if (type == TRIGGER_STRUCT)
+    k_spinlock_key_t key = k_spin_lock(&libs_lock);
+    struct senlib_struct *lib = 0;
+
+    for (int i = 0; i < CONFIG_SENLIB_MAX_INSTANCES; i++)
+    {
+        if (!libs[i].used)
         {
-            // we need a list lookup b/c trigger struct is copied to device
-            struct senlib_struct *next = listend;
-            while (next != 0)
-            {
-                if (next->dev == dev)
-                {
-                    hexval = (uint32_t)next;
-                    break;
-                }
-                next = next->pnext;
-            }
+            lib = &libs[i];
+            memset (lib, 0, sizeof (struct senlib_struct));
+            lib->used = true;
             break;
         }
-
-        // back out sensor_trigger struct 
-        hexval -= sizeof (struct sensor_trigger);
-        if (type == TIMER_WORK_STRUCT)
-            break;
-
-        // back out trig_work struct 
-        hexval -= sizeof (struct k_work);
-        if (type == TIMER_STRUCT)
-            break;
-
-        printk ("Bad pointer type %d passed to get_lib_struct\r\n", type);
-        return 0;
-    } while (false);
-
-    struct senlib_struct *lib = (struct senlib_struct *)hexval;
-#ifdef USE_ID_TAG
-    if (lib->idtag != SENSTRUCT_TAG)
-    {
-        printf ("bad pointer lookup!!!\n");
-        return 0;
-    }
-#endif
-    // See if we match the dev
-    if ((dev != 0) && (lib->dev != dev))
-    {
-        printf ("bad pointer lookup 2!!!\n");
-        return 0;
     }
+    k_spin_unlock(&libs_lock, key);
     return lib;
 }
 
+/*
+ * lib_bind - Lets the trigger handler find the instance by its device.
+ */
+static void lib_bind (struct senlib_struct *lib, bool bound)
+{
+    k_spinlock_key_t key = k_spin_lock(&libs_lock);
+
+    // Once unbound, no more trigger work is queued for it.
+    lib->bound = bound;
+    k_spin_unlock(&libs_lock, key);
+}
+
 /*
  *
  */
 static void sensor_trigger_work_handler(struct k_work *work)
 {
-    struct senlib_struct *lib = get_lib_struct (0, work, TRIGGER_WORK_STRUCT);
+    struct senlib_struct *lib = CONTAINER_OF(work, struct senlib_struct, trig_work);
 
-    if (lib->fn)
+    if (lib->fn && (lib->reasons & ARDCB_LIMITEXCEEDED))
     {
         // Call upper layer.
         (lib->fn)(ARDCB_LIMITEXCEEDED, (void *)&lib->trig, sizeof (struct sensor_trigger), lib->userdata);
@@ -144,12 +235,20 @@ static void sensor_trigger_handler(struct device *dev, struct sensor_trigger *tr
 static void sensor_trigger_handler(const struct device *dev, struct sensor_trigger *trigger)
 #endif
 {
-	ARG_UNUSED(dev);
 	ARG_UNUSED(trigger);
 
-    struct senlib_struct *lib = get_lib_struct (dev, trigger, TRIGGER_STRUCT);
+    // Queued under the lock, so an unbound instance gets no more work.
+    k_spinlock_key_t key = k_spin_lock(&libs_lock);
 
-	k_work_submit(&lib->trig_work);
+    for (int i = 0; i < CONFIG_SENLIB_MAX_INSTANCES; i++)
+    {
+        if (libs[i].bound && (libs[i].dev == dev))
+        {
+            k_work_submit_to_queue(&senlib_workq, &libs[i].trig_work);
+            break;
+        }
+    }
+    k_spin_unlock(&libs_lock, key);
 }
 
 /*
@@ -168,12 +267,231 @@ int senlib_settrigger (void *lib_in, struct sensor_trigger *trig, SenLib_trigger
 
     return 0;
 }
-// Unused at this time.
+static int senlib_readformatted (struct senlib_struct *lib, void *out_data, uint32_t size);
+static void async_read_handler(struct k_work *work);
+static int async_cancel_all (struct senlib_struct *lib);
+static struct k_work_q *async_own_queue (void);
+static void lib_free_handler(struct k_work *work);
+
+/*
+ * sensor_timer_expiry - Period timer expired. Runs in the timer
+ * ISR, so the read is handed to the sensor work queue.
+ */
+static void sensor_timer_expiry(struct k_timer *timer)
+{
+    struct senlib_struct *lib = CONTAINER_OF(timer, struct senlib_struct, trigger_timer);
+
+    k_work_submit_to_queue(&senlib_workq, &lib->timer_work);
+}
+
+/*
+ * sensor_timer_handler - Reads the sensor once per period and passes
+ * the sample to the callback with ARDCB_DATAREADY.
+ */
 static void sensor_timer_handler(struct k_work *work)
 {
-    return;
+    struct senlib_struct *lib = CONTAINER_OF(work, struct senlib_struct, timer_work);
+    struct senlib_period_stats *st = &lib->period_stats;
+    uint32_t expiries, late_us, due;
+    int rc;
+
+    // More than one expiry since the last run means the work 
+    // didn't get to run in time and periods were lost.
+    expiries = k_timer_status_get(&lib->trigger_timer);
+    if (expiries == 0)
+        return;
+    st->missed += expiries - 1;
+    lib->period_cnt += expiries;
+
+    // How late this run is compared to where the period should be.
+    due = lib->period_start + 
+          (uint32_t)k_us_to_cyc_floor64((uint64_t)lib->period_cnt * lib->period_ms * 1000);
+    late_us = (uint32_t)k_cyc_to_us_floor64(k_cycle_get_32() - due);
+    st->samples++;
+    st->jitter_sum_us += late_us;
+    if (late_us > st->jitter_max_us)
+        st->jitter_max_us = late_us;
+
+    rc = senlib_readformatted(lib, lib->sample, lib->sensor.no_of_channels * sizeof (int32_t));
+    if (lib->fn)
+    {
+        if ((rc > 0) && (lib->reasons & ARDCB_DATAREADY))
+            (lib->fn)(ARDCB_DATAREADY, lib->sample, rc, lib->userdata);
+        else if ((rc <= 0) && (lib->reasons & ARDCB_LIBERROR))
+            (lib->fn)(ARDCB_LIBERROR, 0, rc, lib->userdata);
+    }
+}
+
+/*
+ * senlib_setperiod - Samples the sensor every period_ms on the sensor
+ * work queue. 0 stops periodic sampling.
+ */
+int senlib_setperiod (void *lib_in, uint32_t period_ms)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+
+    k_timer_stop(&lib->trigger_timer);
+    lib->use_periodic_measurement = (period_ms != 0);
+    lib->period_ms = period_ms;
+    if (period_ms == 0)
+        return 0;
+
+    memset (&lib->period_stats, 0, sizeof (lib->period_stats));
+    lib->period_cnt = 0;
+    lib->period_start = k_cycle_get_32();
+    k_timer_start(&lib->trigger_timer, K_MSEC(period_ms), K_MSEC(period_ms));
+    return 0;
+}
+
+/*
+ * senlib_getperiodstats - Returns the periodic sampling counters.
+ */
+int senlib_getperiodstats (void *lib_in, struct senlib_period_stats *stats)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+
+    memcpy (stats, &lib->period_stats, sizeof (struct senlib_period_stats));
+    return 0;
+}
+
+
+// Indexes are uint32_t and wrap. ring_slots is a power of two, so the
+// producer and the readers map an index to the same slot across the
+// wrap.
+#define RING_SLOT(lib, idx) \
+    ((struct senlib_slot *)((lib)->ring + ((uint32_t)(idx) & ((lib)->ring_slots - 1)) * (lib)->slot_size))
+
+/*
+ * ring_push - Adds the current raw_data to the sample ring. Only
+ * called with the lib lock held, so there is one producer.
+ */
+static void ring_push (struct senlib_struct *lib, uint32_t timestamp)
+{
+    uint32_t idx = (uint32_t)atomic_get(&lib->ring_head);
+    struct senlib_slot *slot = RING_SLOT(lib, idx);
+
+    // Readers that see an odd seq know the slot is changing.
+    atomic_set(&slot->seq, (atomic_val_t)(idx * 2 + 1));
+    slot->timestamp = timestamp;
+    memcpy (slot->val, lib->sensor.raw_data, 
+            lib->sensor.no_of_channels * sizeof (struct sensor_value));
+    atomic_set(&slot->seq, (atomic_val_t)(idx * 2 + 2));
+    atomic_set(&lib->ring_head, (atomic_val_t)(idx + 1));
+}
+
+/*
+ * senlib_ring_enable - Keeps the last slots samples read from the 
+ * sensor for senlib_ring_read.
+ */
+int senlib_ring_enable (void *lib_in, uint16_t slots)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    uint16_t slot_size;
+    uint8_t *ring;
+
+    if ((lib == 0) || (slots == 0) || (slots > 0x8000))
+        return -EINVAL;
+    if (lib->ring)
+        return -EALREADY;
+    // Round up to a power of two for RING_SLOT.
+    while (slots & (slots - 1))
+        slots = (slots | (slots - 1)) + 1;
+
+    slot_size = sizeof (struct senlib_slot) + 
+                lib->sensor.no_of_channels * sizeof (struct sensor_value);
+    ring = ard_malloc (slots * slot_size);
+    if (ring == 0)
+        return -ENOMEM;
+    memset (ring, 0, slots * slot_size);
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    lib->slot_size = slot_size;
+    lib->ring_slots = slots;
+    atomic_set(&lib->ring_head, 0);
+    lib->ring = ring;
+    k_mutex_unlock(&lib->lock);
+    return 0;
+}
+
+/*
+ * senlib_reader_init - Starts a reader at the next sample.
+ */
+void senlib_reader_init (void *lib_in, struct senlib_reader *rd)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+
+    rd->next = (uint32_t)atomic_get(&lib->ring_head);
+    rd->overruns = 0;
+}
+
+/*
+ * senlib_ring_read - Copies the reader's next sample. Doesn't touch
+ * the sensor, so any number of readers cost no bus traffic. Returns
+ * the number of channels, -EAGAIN if there is no new sample yet.
+ */
+int senlib_ring_read (void *lib_in, struct senlib_reader *rd, uint32_t *timestamp,
+                      struct sensor_value *val, int nvals)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    struct senlib_slot *slot;
+    uint32_t head, seq;
+    int n;
+
+    if ((lib == 0) || (lib->ring == 0))
+        return -EINVAL;
+    n = MIN(nvals, lib->sensor.no_of_channels);
+
+    while (1)
+    {
+        head = (uint32_t)atomic_get(&lib->ring_head);
+        if (rd->next == head)
+            return -EAGAIN;
+
+        // Fell a full ring behind. Skip to the oldest sample still there.
+        if ((uint32_t)(head - rd->next) > lib->ring_slots)
+        {
+            rd->overruns += head - lib->ring_slots - rd->next;
+            rd->next = head - lib->ring_slots;
+        }
+
+        slot = RING_SLOT(lib, rd->next);
+        seq = (uint32_t)atomic_get(&slot->seq);
+        if (seq == rd->next * 2 + 2)
+        {
+            *timestamp = slot->timestamp;
+            memcpy (val, slot->val, n * sizeof (struct sensor_value));
+
+            // If the producer got to the slot while we copied, try again.
+            if ((uint32_t)atomic_get(&slot->seq) == seq)
+            {
+                rd->next++;
+                return n;
+            }
+        }
+        // Overwritten before we got to it.
+        rd->overruns++;
+        rd->next++;
+    }
+}
+
+/*
+ * senlib_getsensor - Returns the sensor definition.
+ */
+const struct senlib_sensor *senlib_getsensor (void *lib_in)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+
+    return &lib->sensor;
 }
 
+/*
+ * senlib_submit - Queues work on the sensor work queue. Can be
+ * called from an ISR.
+ */
+void senlib_submit (struct k_work *work)
+{
+    k_work_submit_to_queue(&senlib_workq, work);
+}
 
 /*
  * senlib_init - Initialize the common sensor code for the sensor.
@@ -194,18 +512,39 @@ void *senlib_init (struct senlib_sensor *in_sensor, SenLib_data_handler_cb cb,
         *prc = -ENODEV;
         return 0;
     }
-    // If we can open the driver, alloc the structure we'll use.
-    struct senlib_struct *lib = ard_malloc (sizeof (struct senlib_struct) + 
-                                            (in_sensor->no_of_channels * sizeof (struct sensor_value)));
-#ifdef USE_ID_TAG
-    // Set tag
-    lib->idtag = SENSTRUCT_TAG;
-#endif
-
-    // Link the alloced structure so we can do a reverse lookup.
-    lib->pnext = listend;
-    listend = lib;
+    if (in_sensor->no_of_channels > SENLIB_MAX_CHANNELS)
+    {
+        *prc = -EINVAL;
+        return 0;
+    }
+    // If we can open the driver, take a slot in the instance table.
+    struct senlib_struct *lib = lib_alloc ();
+    if (lib == 0)
+    {
+        *prc = -ENOMEM;
+        return 0;
+    }
+    k_mutex_init(&lib->lock);
 
+    if (!senlib_workq_started)
+    {
+        senlib_workq_started = true;
+        k_work_q_start(&senlib_workq, senlib_workq_stack,
+                       K_THREAD_STACK_SIZEOF(senlib_workq_stack),
+                       CONFIG_SENLIB_WORKQ_PRIORITY);
+    }
+    if (!async_queues_started)
+    {
+        for (int i = 0; i < CONFIG_SENLIB_ASYNC_THREADS; i++)
+        {
+            k_work_q_start(&async_queues[i], async_stacks[i],
+                           K_THREAD_STACK_SIZEOF(async_stacks[i]),
+                           CONFIG_SENLIB_WORKQ_PRIORITY);
+        }
+        for (int i = 0; i < CONFIG_SENLIB_ASYNC_DEPTH; i++)
+            k_work_init(&async_reqs[i].work, async_read_handler);
+        async_queues_started = true;
+    }
     // Copy the data provided by the upper layer.
     memcpy (&lib->sensor, in_sensor, sizeof (struct senlib_sensor));
 
@@ -215,10 +554,80 @@ void *senlib_init (struct senlib_sensor *in_sensor, SenLib_data_handler_cb cb,
     // Init the callback and timer work structures.
     k_work_init(&lib->trig_work, sensor_trigger_work_handler);
     k_work_init(&lib->timer_work, sensor_timer_handler);
+    k_work_init(&lib->free_work, lib_free_handler);
+    k_timer_init(&lib->trigger_timer, sensor_timer_expiry, NULL);
     lib->dhcb_fn = cb;
+    lib->reasons = ARDCB_EN_ALL;
 
+    // Let the trigger handler find the instance.
+    lib_bind (lib, true);
     return lib;
 }
+/*
+ * flush_handler - Marks the point senlib_flush waits for.
+ */
+static void flush_handler(struct k_work *work)
+{
+    struct senlib_flush_work *fw = CONTAINER_OF(work, struct senlib_flush_work, work);
+
+    k_sem_give(&fw->done);
+}
+
+/*
+ * senlib_flush - Waits until the work queued on the sensor work queue
+ * so far has run. The queue runs its work in order on one thread, so
+ * that is when a work item queued now has run.
+ */
+int senlib_flush (void)
+{
+    struct senlib_flush_work fw;
+
+    if (!senlib_workq_started)
+        return 0;
+    if (k_current_get() == &senlib_workq.thread)
+        return -EDEADLK;
+
+    k_work_init(&fw.work, flush_handler);
+    k_sem_init(&fw.done, 0, 1);
+    k_work_submit_to_queue(&senlib_workq, &fw.work);
+    k_sem_take(&fw.done, K_FOREVER);
+    return 0;
+}
+
+/*
+ * lib_free - Frees what hangs off an instance and its slot.
+ */
+static void lib_free (struct senlib_struct *lib)
+{
+    k_spinlock_key_t key;
+
+    if (lib->ring)
+        ard_free (lib->ring);
+#ifdef CONFIG_SENLIB_STATS
+    if (lib->stats)
+        senlib_stats_free (lib->stats);
+#endif //CONFIG_SENLIB_STATS
+    if (lib->limits)
+    {
+        ard_free (lib->limits);
+        ard_free (lib->limit_evt);
+    }
+    key = k_spin_lock(&libs_lock);
+    lib->used = false;
+    k_spin_unlock(&libs_lock, key);
+}
+
+/*
+ * lib_free_handler - Frees an instance deinitialized from a work 
+ * queue. Queued on an async queue, the sensor work queue may still 
+ * hold work for it. On that queue itself the work has already run.
+ */
+static void lib_free_handler(struct k_work *work)
+{
+    senlib_flush ();
+    lib_free (CONTAINER_OF(work, struct senlib_struct, free_work));
+}
+
 /*
  * senlib_deinit - Free up sensor resources.
  */
@@ -226,45 +635,58 @@ void senlib_deinit (void *lib_in)
 {
     struct senlib_struct *lib = (struct senlib_struct *)lib_in;
 
-    // we need to find the structure in the list and delink it
-    struct senlib_struct *next = listend;
-    if (lib == next)
-    {
-        listend = lib->pnext;
-    }
+    // Stop periodic sampling and triggers before the structure goes
+    // away. An expiry or trigger may already have queued work.
+    k_timer_stop(&lib->trigger_timer);
+    lib_bind (lib, false);
+
+    // Free once the work queued for it has run. On a queue holding
+    // that work it can't be waited for, so the free is queued behind it.
+    if (async_cancel_all (lib) == -EDEADLK)
+        k_work_submit_to_queue(async_own_queue (), &lib->free_work);
+    else if (senlib_flush () == -EDEADLK)
+        senlib_submit (&lib->free_work);
     else
-    {
-        struct senlib_struct *old = listend;
-        while (next != 0)
-        {
-            if (lib == next)
-            {
-                old->pnext = lib->pnext;
-                break;
-            }
-            old = next;
-            next = next->pnext;
-        }
-    }
-    ard_free (lib);
+        lib_free (lib);
     return;
 }
 
 /*
- * senlib_readsensor - Read the sensor
+ * limit_merge - Adds the events of a read to the ones not yet reported.
+ * A channel keeps one pending event: the newest value and band, the 
+ * causes of every read and the value it was last reported at.
+ * Called with the lib lock held.
  */
-int senlib_readsensor(void *lib_in, void *out_data, int size)   
+static void limit_merge (struct senlib_struct *lib, 
+                         const struct senlib_limit_event *evt, int n)
 {
-    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
-
-    double *data = (double *)out_data;
-    
-    if (size < (lib->sensor.no_of_channels * sizeof (double)))
+    for (int i = 0; i < n; i++)
     {
-        return -ENOSR;
+        struct senlib_limit_event *p = lib->limit_evt;
+        int j;
+
+        for (j = 0; j < lib->limit_pending; j++)
+            if (p[j].channel == evt[i].channel)
+                break;
+        if (j == lib->limit_pending)
+        {
+            p[j] = evt[i];
+            lib->limit_pending++;
+            continue;
+        }
+        p[j].cause |= evt[i].cause;
+        p[j].band = evt[i].band;
+        p[j].value = evt[i].value;
     }
+}
 
-	int err;
+/*
+ * fetch_locked - Reads all channels of the sensor into raw_data.
+ * Called with the lib lock held.
+ */
+static int fetch_locked (struct senlib_struct *lib)
+{
+    int err;
 
     err = sensor_sample_fetch_chan(lib->dev, SENSOR_CHAN_ALL);
     if (err) {
@@ -273,24 +695,467 @@ int senlib_readsensor(void *lib_in, void *out_data, int size)
 
         return err;
     }
-    int data_size = 0;
 	for (int i = 0; i < lib->sensor.no_of_channels; i++) 
     {
 		err = sensor_channel_get(lib->dev, lib->sensor.channels[i], &lib->sensor.raw_data[i]);
 		if (err) {
 			printk("Failed to fetch data from %s, error: %d\n",
 				lib->sensor.dev_name, err);
-		} else {
-			//(db)k_spinlock_key_t key = k_spin_lock(&(env_sensors[i]->lock));
-
-			data[i] = sensor_value_to_double(&lib->sensor.raw_data[i]);
-			//(db)k_spin_unlock(&(env_sensors[i]->lock), key);
-            data_size += sizeof (double);
+            return err;
 		}
 	}
-    return data_size;
+    lib->cache_ticks = k_uptime_ticks();
+    lib->cache_valid = true;
+    for (int i = 0; i < lib->sensor.no_of_channels; i++) 
+        lib->cache[i] = senlib_value_to_milli(&lib->sensor.raw_data[i]);
+
+    if (lib->ring)
+        ring_push (lib, (uint32_t)k_ticks_to_us_floor64(lib->cache_ticks));
+#ifdef CONFIG_SENLIB_STATS
+    if (lib->stats)
+        senlib_stats_add (lib->stats, lib->cache);
+#endif //CONFIG_SENLIB_STATS
+    // Events are reported by fire_limits once the lock is dropped.
+    if (lib->limits)
+    {
+        struct senlib_limit_event evt[lib->sensor.no_of_channels];
+
+        limit_merge (lib, evt, senlib_limits_check (lib->limits, lib->cache, evt));
+    }
+    return 0;
+}
+
+/*
+ * fire_limits - Reports the pending change events with ARDCB_CHANGED.
+ * Called after the lock is released so the callback may read the 
+ * sensor.
+ */
+static void fire_limits (struct senlib_struct *lib)
+{
+    struct senlib_limit_event evt[lib->sensor.no_of_channels];
+    int n;
+
+    if (lib->limits == 0)
+        return;
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    n = lib->limit_pending;
+    memcpy (evt, lib->limit_evt, n * sizeof (struct senlib_limit_event));
+    lib->limit_pending = 0;
+    k_mutex_unlock(&lib->lock);
+
+    if ((lib->fn == 0) || !(lib->reasons & ARDCB_CHANGED))
+        return;
+    for (int i = 0; i < n; i++)
+        (lib->fn)(ARDCB_CHANGED, &evt[i], sizeof (struct senlib_limit_event), lib->userdata);
+}
+
+/*
+ * senlib_setlimit - Sets up change detection for one channel.
+ */
+int senlib_setlimit (void *lib_in, const struct senlib_limit_cfg *cfg)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    int rc = 0;
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    if (lib->limits == 0)
+    {
+        lib->limits = senlib_limits_alloc (lib->sensor.no_of_channels);
+        lib->limit_evt = ard_malloc (lib->sensor.no_of_channels * sizeof (struct senlib_limit_event));
+        if ((lib->limits == 0) || (lib->limit_evt == 0))
+        {
+            if (lib->limits)
+                ard_free (lib->limits);
+            if (lib->limit_evt)
+                ard_free (lib->limit_evt);
+            lib->limits = 0;
+            lib->limit_evt = 0;
+            rc = -ENOMEM;
+        }
+    }
+    if (rc == 0)
+        rc = senlib_limits_setup (lib->limits, cfg);
+    k_mutex_unlock(&lib->lock);
+    return rc;
+}
+
+/*
+ * senlib_getlimit - Reads the change detection setup of one channel.
+ */
+int senlib_getlimit (void *lib_in, struct senlib_limit_cfg *cfg)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    int rc = -EINVAL;
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    if (lib->limits)
+        rc = senlib_limits_get (lib->limits, cfg);
+    k_mutex_unlock(&lib->lock);
+    return rc;
+}
+
+/*
+ * senlib_setstats - Sets up statistics for one channel.
+ */
+int senlib_setstats (void *lib_in, const struct senlib_stats_cfg *cfg)
+{
+#ifdef CONFIG_SENLIB_STATS
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    int rc;
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    if (lib->stats == 0)
+        lib->stats = senlib_stats_alloc (lib->sensor.no_of_channels);
+    if (lib->stats)
+        rc = senlib_stats_setup (lib->stats, cfg);
+    else
+        rc = -ENOMEM;
+    k_mutex_unlock(&lib->lock);
+    return rc;
+#else
+    return -ENOTSUP;
+#endif //CONFIG_SENLIB_STATS
+}
+
+/*
+ * senlib_getstats - Reads the statistics of one channel.
+ */
+int senlib_getstats (void *lib_in, struct senlib_stats_result *res)
+{
+#ifdef CONFIG_SENLIB_STATS
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    int rc = -EINVAL;
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    if (lib->stats)
+        rc = senlib_stats_result (lib->stats, res);
+    k_mutex_unlock(&lib->lock);
+    return rc;
+#else
+    return -ENOTSUP;
+#endif //CONFIG_SENLIB_STATS
 }
 
+/*
+ * senlib_readsensor_milli - Read the sensor as milli-units. No
+ * floating point is used.
+ */
+int senlib_readsensor_milli (void *lib_in, int32_t *out_data, int size)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    int err;
+
+    if (size < (lib->sensor.no_of_channels * sizeof (int32_t)))
+    {
+        return -ENOSR;
+    }
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    err = fetch_locked (lib);
+    if (err == 0)
+        memcpy (out_data, lib->cache, lib->sensor.no_of_channels * sizeof (int32_t));
+    k_mutex_unlock(&lib->lock);
+    if (err)
+        return err;
+    fire_limits (lib);
+    return lib->sensor.no_of_channels * sizeof (int32_t);
+}
+
+/*
+ * senlib_readsensor_cached - Read the sensor as milli-units, or
+ * return the last sample if it is at most max_age_ms old.
+ */
+int senlib_readsensor_cached (void *lib_in, int32_t *out_data, int size, uint32_t max_age_ms)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    int64_t asked = k_uptime_ticks();
+    bool fetched = false;
+    int err = 0;
+
+    if (size < (lib->sensor.no_of_channels * sizeof (int32_t)))
+    {
+        return -ENOSR;
+    }
+
+    // A fetch holds the lock, so readers that come while it runs
+    // wait here and then find a sample newer than their request.
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    if (lib->cache_valid && (lib->cache_ticks >= asked))
+        lib->cache_stats.coalesced++;
+    else if (lib->cache_valid && (k_ticks_to_ms_floor64(asked - lib->cache_ticks) <= max_age_ms))
+        lib->cache_stats.hits++;
+    else
+    {
+        lib->cache_stats.misses++;
+        err = fetch_locked (lib);
+        fetched = true;
+    }
+    if (err == 0)
+        memcpy (out_data, lib->cache, lib->sensor.no_of_channels * sizeof (int32_t));
+    k_mutex_unlock(&lib->lock);
+    if (err)
+        return err;
+    if (fetched)
+        fire_limits (lib);
+    return lib->sensor.no_of_channels * sizeof (int32_t);
+}
+
+/*
+ * senlib_getcachestats - Copies the cache counters.
+ */
+int senlib_getcachestats (void *lib_in, struct senlib_cache_stats *stats)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    memcpy (stats, &lib->cache_stats, sizeof (struct senlib_cache_stats));
+    k_mutex_unlock(&lib->lock);
+    return 0;
+}
+
+/*
+ * async_read_handler - Runs one senlib_read_async request on its
+ * queue.
+ */
+static void async_read_handler(struct k_work *work)
+{
+    struct senlib_async *req = CONTAINER_OF(work, struct senlib_async, work);
+    struct senlib_struct *lib = req->lib;
+    int32_t sample[lib->sensor.no_of_channels];
+    struct k_sem *freed;
+    k_spinlock_key_t key;
+    bool run;
+    int rc = 0;
+
+    key = k_spin_lock(&async_lock);
+    run = (req->state == ASYNC_QUEUED);
+    if (run)
+        req->state = ASYNC_READING;
+    k_spin_unlock(&async_lock, key);
+
+    if (run)
+        rc = senlib_readformatted(lib, sample, sizeof (sample));
+
+    // Cancelled while the sensor was read drops the sample.
+    key = k_spin_lock(&async_lock);
+    run = (req->state == ASYNC_READING);
+    if (run)
+        req->state = ASYNC_CALLING;
+    k_spin_unlock(&async_lock, key);
+
+    if (run)
+    {
+        if (rc > 0)
+            (req->fn)(ARDCB_DATAREADY, sample, rc, req->userdata);
+        else
+            (req->fn)(ARDCB_LIBERROR, 0, rc, req->userdata);
+    }
+
+    key = k_spin_lock(&async_lock);
+    req->state = ASYNC_FREE;
+    req->gen++;
+    freed = req->freed;
+    req->freed = 0;
+    k_spin_unlock(&async_lock, key);
+    if (freed)
+        k_sem_give(freed);
+}
+
+/*
+ * senlib_read_async - Queues a read of the sensor. fn is called from
+ * the read's work queue with the formatted sample.
+ */
+int senlib_read_async (void *lib_in, SenLib_trigger_fn fn, uint32_t userdata)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    int load[CONFIG_SENLIB_ASYNC_THREADS] = { 0 };
+    struct senlib_async *req = 0;
+    k_spinlock_key_t key;
+    int i, q = -1;
+
+    if ((lib == 0) || (fn == 0))
+        return -EINVAL;
+
+    key = k_spin_lock(&async_lock);
+    if (!async_queues_started)
+    {
+        k_spin_unlock(&async_lock, key);
+        return -EAGAIN;
+    }
+    for (i = 0; i < CONFIG_SENLIB_ASYNC_DEPTH; i++)
+    {
+        struct senlib_async *r = &async_reqs[i];
+
+        if (r->state == ASYNC_FREE)
+        {
+            if (req == 0)
+                req = r;
+            continue;
+        }
+        load[r->queue]++;
+        // Reads of one sensor stay on one queue, in order.
+        if (r->lib == lib)
+            q = r->queue;
+    }
+    if (req == 0)
+    {
+        k_spin_unlock(&async_lock, key);
+        return -EBUSY;
+    }
+    if (q < 0)
+    {
+        for (q = 0, i = 1; i < CONFIG_SENLIB_ASYNC_THREADS; i++)
+        {
+            if (load[i] < load[q])
+                q = i;
+        }
+    }
+    req->lib = lib;
+    req->fn = fn;
+    req->userdata = userdata;
+    req->queue = q;
+    req->state = ASYNC_QUEUED;
+    k_spin_unlock(&async_lock, key);
+
+    k_work_submit_to_queue(&async_queues[q], &req->work);
+    return ((req->gen & 0x7fff) << 8) | (req - async_reqs);
+}
+
+/*
+ * senlib_read_cancel - Cancels a senlib_read_async request.
+ */
+int senlib_read_cancel (int id)
+{
+    struct senlib_async *req;
+    k_spinlock_key_t key;
+    int rc;
+
+    if ((id < 0) || ((id & 0xff) >= CONFIG_SENLIB_ASYNC_DEPTH))
+        return -EINVAL;
+    req = &async_reqs[id & 0xff];
+
+    key = k_spin_lock(&async_lock);
+    if ((req->state == ASYNC_FREE) || ((req->gen & 0x7fff) != (id >> 8)))
+        rc = -EALREADY;
+    else if (req->state == ASYNC_CALLING)
+        rc = -EINPROGRESS;
+    else
+    {
+        // Work can't be taken back off a queue in this kernel, so
+        // the handler sees the state and drops the request.
+        req->state = ASYNC_CANCELLED;
+        rc = 0;
+    }
+    k_spin_unlock(&async_lock, key);
+    return rc;
+}
+
+/*
+ * async_own_queue - The async queue the caller runs on, or 0.
+ */
+static struct k_work_q *async_own_queue (void)
+{
+    for (int i = 0; i < CONFIG_SENLIB_ASYNC_THREADS; i++)
+    {
+        if (k_current_get() == &async_queues[i].thread)
+            return &async_queues[i];
+    }
+    return 0;
+}
+
+/*
+ * async_cancel_all - Cancels the requests of an instance and waits
+ * until their handlers are done with it. Requests on the caller's own
+ * queue, as when called from an async read callback, only run after 
+ * it returns. They are cancelled but not waited for, and -EDEADLK 
+ * tells the caller to queue its cleanup behind them.
+ */
+static int async_cancel_all (struct senlib_struct *lib)
+{
+    struct k_work_q *own = async_own_queue ();
+    struct k_sem freed;
+    k_spinlock_key_t key;
+    bool behind = false;
+    int n = 0;
+
+    k_sem_init(&freed, 0, CONFIG_SENLIB_ASYNC_DEPTH);
+    key = k_spin_lock(&async_lock);
+    for (int i = 0; i < CONFIG_SENLIB_ASYNC_DEPTH; i++)
+    {
+        struct senlib_async *r = &async_reqs[i];
+
+        if ((r->state == ASYNC_FREE) || (r->lib != lib))
+            continue;
+        if ((r->state == ASYNC_QUEUED) || (r->state == ASYNC_READING))
+            r->state = ASYNC_CANCELLED;
+        if (own == &async_queues[r->queue])
+        {
+            behind = true;
+            continue;
+        }
+        r->freed = &freed;
+        n++;
+    }
+    k_spin_unlock(&async_lock, key);
+
+    while (n--)
+        k_sem_take(&freed, K_FOREVER);
+    return behind ? -EDEADLK : 0;
+}
+
+/*
+ * senlib_readformatted - Read the sensor and format it with the 
+ * data handler callback passed to senlib_init.
+ */
+static int senlib_readformatted (struct senlib_struct *lib, void *out_data, uint32_t size)
+{
+    int err;
+
+    if (lib->dhcb_fn == 0)
+        return senlib_readsensor_milli (lib, out_data, size);
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    err = fetch_locked (lib);
+    if (err == 0)
+        (lib->dhcb_fn)(lib->sensor.raw_data, out_data, &size);
+    k_mutex_unlock(&lib->lock);
+    if (err)
+        return err;
+    fire_limits (lib);
+    return size;
+}
+
+#ifdef CONFIG_SENLIB_DOUBLE_API
+/*
+ * senlib_readsensor - Read the sensor as doubles.
+ */
+int senlib_readsensor(void *lib_in, void *out_data, int size)   
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    double *data = (double *)out_data;
+    int err;
+    
+    if (size < (lib->sensor.no_of_channels * sizeof (double)))
+    {
+        return -ENOSR;
+    }
+
+    k_mutex_lock(&lib->lock, K_FOREVER);
+    err = fetch_locked (lib);
+    if (err == 0)
+    {
+        for (int i = 0; i < lib->sensor.no_of_channels; i++) 
+            data[i] = sensor_value_to_double(&lib->sensor.raw_data[i]);
+    }
+    k_mutex_unlock(&lib->lock);
+    if (err)
+        return err;
+    fire_limits (lib);
+    return lib->sensor.no_of_channels * sizeof (double);
+}
+#endif //CONFIG_SENLIB_DOUBLE_API
+
 /*
  * senlib_savecb - Save callback function pointer
  */
@@ -301,3 +1166,14 @@ int senlib_savecb (void *lib_in, SenLib_trigger_fn fn, uint32_t userdata)
     lib->userdata = userdata;
     return 0;
 }
+
+/*
+ * senlib_setreasons - Selects the ARDCB_xxx reasons passed to the
+ * callback.
+ */
+int senlib_setreasons (void *lib_in, uint32_t reasons)
+{
+    struct senlib_struct *lib = (struct senlib_struct *)lib_in;
+    lib->reasons = reasons;
+    return 0;
+}
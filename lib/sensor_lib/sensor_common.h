@@ -6,32 +6,38 @@
 
 #include <zephyr/types.h>
 #include <drivers/sensor.h>
+#include "sensor_stats.h"
+#include "sensor_limit.h"
+#include "sensor_spectrum.h"
+#include "sensor_registry.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Most channels an instance can have
+#define SENLIB_MAX_CHANNELS         4
+
 /* Flags set when a trigger ocurrs */
 #define REASONNUMBER(a)            (1 << a)
 #define ARDCB_EN_ALL                  0xFFFFFFFF
 #define ARDCB_EN_LIBERROR             0x0001
 #define ARDCB_EN_DATAREADY            0x0002
 #define ARDCB_EN_LIMITEXCEEDED        0x0003
+#define ARDCB_EN_CHANGED              0x0004
 
 /* Data could not be obtained from the device */
 #define ARDCB_LIBERROR         REASONNUMBER(ARDCB_EN_LIBERROR)
 /* Data was read from the device*/
 #define ARDCB_DATAREADY        REASONNUMBER(ARDCB_EN_DATAREADY)
-/* Data was obtained from the device when a trigger ocurred*/
+/* Data was obtained from the device when a trigger ocurred. The data
+ * is the struct sensor_trigger. */
 #define ARDCB_LIMITEXCEEDED    REASONNUMBER(ARDCB_EN_LIMITEXCEEDED)
+/* A channel changed past a limit set with senlib_setlimit. The data
+ * is a struct senlib_limit_event. */
+#define ARDCB_CHANGED          REASONNUMBER(ARDCB_EN_CHANGED)
 
 
-// Add an id field for debugging
-#define USE_ID_TAG 
-#ifdef USE_ID_TAG
-#define SENSTRUCT_TAG 0xdeadbeef
-#endif
-
 /**
  * @brief Callback function called after data is read to format 
  * that data
@@ -39,7 +45,8 @@ extern "C" {
  * @param read_data Pointer to data which was read from the device.
  * Usually is of type array of sensor_value with size as the number
  * of channels
- * @param out_data Pointer to the formatted data 
+ * @param out_data Pointer to the formatted data. Room for one int32_t
+ * per channel.
  * @param psize Size of the formatted data
  */
 typedef void (*SenLib_data_handler_cb)(void *read_data, void *out_data, uint32_t *psize);
@@ -78,6 +85,34 @@ struct senlib_sensor {
     struct sensor_value *raw_data;
 };
 
+/**
+ * Periodic sampling counters. Jitter is how late each sample was
+ * taken compared to its place on the period grid.
+ */
+struct senlib_period_stats {
+    uint32_t samples;           // Samples taken
+    uint32_t missed;            // Periods lost because a sample was still running
+    uint32_t jitter_max_us;     // Latest a sample was taken
+    uint32_t jitter_sum_us;     // Divide by samples for the mean
+};
+
+/**
+ * Counters of senlib_readsensor_cached.
+ */
+struct senlib_cache_stats {
+    uint32_t hits;              // Last sample was young enough
+    uint32_t coalesced;         // Waited for a read already running
+    uint32_t misses;            // Read the sensor
+};
+
+/**
+ * Read position of one consumer of a sensor's sample ring.
+ */
+struct senlib_reader {
+    uint32_t next;              // Index of the next sample to read
+    uint32_t overruns;          // Samples overwritten before they were read
+};
+
 // Setcallback structure
 struct envsetcbstruct {
     uint32_t reasonflags;
@@ -92,25 +127,170 @@ void *senlib_init (struct senlib_sensor *in_sensor,
                    SenLib_data_handler_cb cb, int *prc);
 
 /*
- * 
+ * Cancels the instance's asynchronous reads and frees it once its
+ * queued work has run. May be called from one of its own callbacks,
+ * an async read callback included; the free then runs after it.
  */
 void senlib_deinit (void *lib_in);
 
 /*
- * 
+ * Reads all channels as milli-units (value * 1000) in int32_t. 
+ * Returns the bytes written or a negative error.
+ */
+int senlib_readsensor_milli (void *lib_in, int32_t *out_data, int size);
+
+#ifdef CONFIG_SENLIB_DOUBLE_API
+/*
+ * Reads all channels as doubles. The 9160 FPU is single precision,
+ * so each conversion runs in software.
  */
 int senlib_readsensor(void *lib_in, void *out_data, int size);
+#endif //CONFIG_SENLIB_DOUBLE_API
+
+/*
+ * Converts a sensor value to milli-units without floating point.
+ * val2 has the same sign as val1, so the sum is exact to 1/1000.
+ */
+static inline int32_t senlib_value_to_milli (const struct sensor_value *val)
+{
+    return val->val1 * 1000 + val->val2 / 1000;
+}
+
+/*
+ * Divides a milli-unit value down to an int16_t, saturating.
+ */
+static inline int16_t senlib_milli_to_i16 (int32_t milli, int32_t div)
+{
+    int32_t v = milli / div;
+
+    if (v > INT16_MAX)
+        return INT16_MAX;
+    if (v < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t)v;
+}
 
 /*
  * 
  */
 int senlib_savecb (void *lib_in, SenLib_trigger_fn fn, uint32_t userdata);
 
+/*
+ * Selects the ARDCB_xxx reasons the callback is called for. All are
+ * on after init.
+ */
+int senlib_setreasons (void *lib_in, uint32_t reasons);
+
 /*
  * 
  */
 int senlib_settrigger (void *lib_in, struct sensor_trigger *trig, SenLib_trigger_fn fn, uint32_t userdata);
 
+/*
+ * Returns the sensor definition the library was initialized with.
+ */
+const struct senlib_sensor *senlib_getsensor (void *lib_in);
+
+/*
+ * Runs work on the sensor library work queue.
+ */
+void senlib_submit (struct k_work *work);
+
+/*
+ * Waits until the work on the sensor library work queue has run,
+ * e.g. before freeing a buffer a handler may still be using. Returns
+ * -EDEADLK when called from the work queue itself.
+ */
+int senlib_flush (void);
+
+/*
+ * Like senlib_readsensor_milli, but returns the last sample read if
+ * it is no older than max_age_ms. Callers that come while the sensor
+ * is being read wait for that read and share its sample. 
+ */
+int senlib_readsensor_cached (void *lib_in, int32_t *out_data, int size, uint32_t max_age_ms);
+
+/*
+ * Copies the senlib_readsensor_cached counters.
+ */
+int senlib_getcachestats (void *lib_in, struct senlib_cache_stats *stats);
+
+/*
+ * Queues a read of the sensor and returns at once. fn is called from
+ * a sensor library work queue with ARDCB_DATAREADY and the sample,
+ * formatted like the synchronous reads, or ARDCB_LIBERROR and the
+ * error in len. Returns a request id for senlib_read_cancel, or
+ * -EBUSY when CONFIG_SENLIB_ASYNC_DEPTH reads are already queued.
+ */
+int senlib_read_async (void *lib_in, SenLib_trigger_fn fn, uint32_t userdata);
+
+/*
+ * Cancels a senlib_read_async request. Returns 0 if fn won't be
+ * called, -EINPROGRESS if it is being called and -EALREADY if the
+ * request has finished.
+ */
+int senlib_read_cancel (int id);
+
+/*
+ * Keeps the last slots samples read from the sensor, with the time
+ * they were read, so several consumers can share one read. slots is
+ * rounded up to a power of two, at most 32768.
+ */
+int senlib_ring_enable (void *lib_in, uint16_t slots);
+
+/*
+ * Starts a reader at the next sample to be read from the sensor.
+ */
+void senlib_reader_init (void *lib_in, struct senlib_reader *rd);
+
+/*
+ * Copies the reader's next sample from the ring. Lock free, so it
+ * doesn't hold up the reads. Returns the channels copied or -EAGAIN
+ * when there is no new sample. Samples the reader fell too far behind
+ * for are counted in rd->overruns.
+ */
+int senlib_ring_read (void *lib_in, struct senlib_reader *rd, uint32_t *timestamp,
+                      struct sensor_value *val, int nvals);
+
+/*
+ * Sets up windowed statistics (min, max, mean, standard deviation and
+ * a percentile) of one channel. They are updated with every read.
+ */
+int senlib_setstats (void *lib_in, const struct senlib_stats_cfg *cfg);
+
+/*
+ * Reads the statistics of res->channel. See senlib_stats_result.
+ */
+int senlib_getstats (void *lib_in, struct senlib_stats_result *res);
+
+/*
+ * Sets up software change detection for one channel. On every read,
+ * a channel that moved past its dead band or into another band is 
+ * reported with ARDCB_CHANGED and a struct senlib_limit_event. A
+ * channel that changes again before it is reported gives one event
+ * with the newest value, all causes seen and the last reported value.
+ */
+int senlib_setlimit (void *lib_in, const struct senlib_limit_cfg *cfg);
+
+/*
+ * Reads the change detection setup of cfg->channel.
+ */
+int senlib_getlimit (void *lib_in, struct senlib_limit_cfg *cfg);
+
+/*
+ * Samples the sensor every period_ms and passes each sample to the
+ * callback saved with senlib_savecb as ARDCB_DATAREADY. The sample
+ * is formatted by the data handler passed to senlib_init, or is an
+ * int32_t per channel in milli-units if there is none. 0 stops.
+ */
+int senlib_setperiod (void *lib_in, uint32_t period_ms);
+
+/*
+ * Copies the periodic sampling counters. They are cleared when
+ * the period is set.
+ */
+int senlib_getperiodstats (void *lib_in, struct senlib_period_stats *stats);
+
 
 #ifdef __cplusplus
 }
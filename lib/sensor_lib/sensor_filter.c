@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * FIR decimation and biquad stages for sensor streams. See
+ * sensor_filter.h.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "sensor_filter.h"
+
+#if !defined(CONFIG_CMSIS_DSP) && defined(__ARM_FEATURE_DSP)
+// __SMLALD and __SSAT from the CMSIS core headers soc.h pulls in
+#include <soc.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+//----------------------------------------------------
+// lowpass - Hamming windowed sinc, normalized to a DC gain of 1.
+//----------------------------------------------------
+static void lowpass(float *h, uint16_t taps, uint32_t cutoff_hz, uint32_t fs_hz)
+{
+    float fc = (float)cutoff_hz / fs_hz;
+    float mid = (taps - 1) / 2.0f;
+    float sum = 0;
+
+    for (int i = 0; i < taps; i++)
+    {
+        float t = i - mid;
+        float w = 0.54f - 0.46f * cosf(2 * (float)M_PI * i / (taps - 1));
+
+        h[i] = (t == 0) ? 2 * fc : sinf(2 * (float)M_PI * fc * t) / ((float)M_PI * t);
+        h[i] *= w;
+        sum += h[i];
+    }
+    for (int i = 0; i < taps; i++)
+        h[i] /= sum;
+}
+
+/*
+ * senlib_fir_lowpass_q15 - Low-pass coefficients in q15.
+ */
+void senlib_fir_lowpass_q15 (int16_t *coeffs, uint16_t taps, uint32_t cutoff_hz, uint32_t fs_hz)
+{
+    float h[taps];
+
+    lowpass (h, taps, cutoff_hz, fs_hz);
+    for (int i = 0; i < taps; i++)
+        coeffs[i] = (int16_t)MAX(MIN(lroundf(h[i] * 32768.0f), INT16_MAX), INT16_MIN);
+}
+
+/*
+ * senlib_fir_lowpass_q31 - Low-pass coefficients in q31.
+ */
+void senlib_fir_lowpass_q31 (int32_t *coeffs, uint16_t taps, uint32_t cutoff_hz, uint32_t fs_hz)
+{
+    float h[taps];
+
+    lowpass (h, taps, cutoff_hz, fs_hz);
+    for (int i = 0; i < taps; i++)
+        coeffs[i] = (int32_t)MAX(MIN(llroundf(h[i] * 2147483648.0f), INT32_MAX), INT32_MIN);
+}
+
+/*
+ * senlib_fir_q15_init - Sets up a q15 decimating FIR.
+ */
+int senlib_fir_q15_init (struct senlib_fir_q15 *f, uint16_t taps, uint8_t m,
+                         const int16_t *coeffs, int16_t *state, uint16_t block)
+{
+    if ((m == 0) || (block == 0) || (block % m))
+        return -EINVAL;
+
+    f->taps = taps;
+    f->m = m;
+    f->block = block;
+    f->coeffs = coeffs;
+    f->state = state;
+    memset (state, 0, (taps + block - 1) * sizeof (int16_t));
+#ifdef CONFIG_CMSIS_DSP
+    if (arm_fir_decimate_init_q15(&f->inst, taps, m, (q15_t *)coeffs, state, block) != ARM_MATH_SUCCESS)
+        return -EINVAL;
+#endif
+    return 0;
+}
+
+/*
+ * senlib_fir_q31_init - Sets up a q31 decimating FIR.
+ */
+int senlib_fir_q31_init (struct senlib_fir_q31 *f, uint16_t taps, uint8_t m,
+                         const int32_t *coeffs, int32_t *state, uint16_t block)
+{
+    if ((m == 0) || (block == 0) || (block % m))
+        return -EINVAL;
+
+    f->taps = taps;
+    f->m = m;
+    f->block = block;
+    f->coeffs = coeffs;
+    f->state = state;
+    memset (state, 0, (taps + block - 1) * sizeof (int32_t));
+#ifdef CONFIG_CMSIS_DSP
+    if (arm_fir_decimate_init_q31(&f->inst, taps, m, (q31_t *)coeffs, state, block) != ARM_MATH_SUCCESS)
+        return -EINVAL;
+#endif
+    return 0;
+}
+
+/*
+ * senlib_biquad_q31_init - Sets up a q31 biquad cascade.
+ */
+void senlib_biquad_q31_init (struct senlib_biquad_q31 *f, uint8_t stages,
+                             const int32_t *coeffs, int32_t *state, uint8_t post_shift)
+{
+    f->stages = stages;
+    f->post_shift = post_shift;
+    f->coeffs = coeffs;
+    f->state = state;
+    memset (state, 0, 4 * stages * sizeof (int32_t));
+#ifdef CONFIG_CMSIS_DSP
+    arm_biquad_cascade_df1_init_q31(&f->inst, stages, (q31_t *)coeffs, state, post_shift);
+#endif
+}
+
+/*
+ * senlib_biquad_f32_init - Sets up a float biquad cascade.
+ */
+void senlib_biquad_f32_init (struct senlib_biquad_f32 *f, uint8_t stages,
+                             const float *coeffs, float *state)
+{
+    f->stages = stages;
+    f->coeffs = coeffs;
+    f->state = state;
+    memset (state, 0, 2 * stages * sizeof (float));
+#ifdef CONFIG_CMSIS_DSP
+    arm_biquad_cascade_df2T_init_f32(&f->inst, stages, (float32_t *)coeffs, state);
+#endif
+}
+
+#ifndef CONFIG_CMSIS_DSP
+//----------------------------------------------------
+// dot_q15 - Dot product of two q15 vectors into a q34.30 sum.
+//----------------------------------------------------
+static int64_t dot_q15(const int16_t *a, const int16_t *b, int n)
+{
+    int64_t acc = 0;
+    int i = 0;
+
+#ifdef __ARM_FEATURE_DSP
+    // Two multiply-accumulates per instruction
+    for (; i + 1 < n; i += 2)
+    {
+        uint32_t pa, pb;
+
+        memcpy (&pa, &a[i], 4);
+        memcpy (&pb, &b[i], 4);
+        acc = __SMLALD(pa, pb, acc);
+    }
+#endif
+    for (; i < n; i++)
+        acc += (int32_t)a[i] * b[i];
+    return acc;
+}
+#endif
+
+/*
+ * senlib_fir_q15 - Filters and decimates n q15 samples.
+ */
+int senlib_fir_q15 (struct senlib_fir_q15 *f, const int16_t *in, int16_t *out, uint32_t n)
+{
+    int outs = 0;
+
+    if (n % f->m)
+        return -EINVAL;
+
+    while (n)
+    {
+        uint32_t cnt = MIN(n, f->block);
+
+#ifdef CONFIG_CMSIS_DSP
+        arm_fir_decimate_q15(&f->inst, (q15_t *)in, out, cnt);
+#else
+        // Delay line: taps - 1 old samples followed by the new block
+        int16_t *hist = f->state + f->taps - 1;
+
+        memcpy (hist, in, cnt * sizeof (int16_t));
+        for (uint32_t i = f->m; i <= cnt; i += f->m)
+        {
+            int32_t v = (int32_t)(dot_q15(hist + i - f->taps, f->coeffs, f->taps) >> 15);
+            out[(i / f->m) - 1] = (int16_t)MAX(MIN(v, INT16_MAX), INT16_MIN);
+        }
+        memmove (f->state, f->state + cnt, (f->taps - 1) * sizeof (int16_t));
+#endif
+        in += cnt;
+        out += cnt / f->m;
+        outs += cnt / f->m;
+        n -= cnt;
+    }
+    return outs;
+}
+
+/*
+ * senlib_fir_q31 - Filters and decimates n q31 samples.
+ */
+int senlib_fir_q31 (struct senlib_fir_q31 *f, const int32_t *in, int32_t *out, uint32_t n)
+{
+    int outs = 0;
+
+    if (n % f->m)
+        return -EINVAL;
+
+    while (n)
+    {
+        uint32_t cnt = MIN(n, f->block);
+
+#ifdef CONFIG_CMSIS_DSP
+        arm_fir_decimate_q31(&f->inst, (q31_t *)in, out, cnt);
+#else
+        int32_t *hist = f->state + f->taps - 1;
+
+        memcpy (hist, in, cnt * sizeof (int32_t));
+        for (uint32_t i = f->m; i <= cnt; i += f->m)
+        {
+            const int32_t *x = hist + i - f->taps;
+            int64_t acc = 0;
+
+            for (int k = 0; k < f->taps; k++)
+                acc += (int64_t)x[k] * f->coeffs[k];
+            out[(i / f->m) - 1] = (int32_t)(acc >> 31);
+        }
+        memmove (f->state, f->state + cnt, (f->taps - 1) * sizeof (int32_t));
+#endif
+        in += cnt;
+        out += cnt / f->m;
+        outs += cnt / f->m;
+        n -= cnt;
+    }
+    return outs;
+}
+
+/*
+ * senlib_biquad_q31 - Filters n q31 samples.
+ */
+int senlib_biquad_q31 (struct senlib_biquad_q31 *f, const int32_t *in, int32_t *out, uint32_t n)
+{
+#ifdef CONFIG_CMSIS_DSP
+    arm_biquad_cascade_df1_q31(&f->inst, (q31_t *)in, out, n);
+#else
+    const int32_t *src = in;
+
+    for (int s = 0; s < f->stages; s++)
+    {
+        const int32_t *c = &f->coeffs[5 * s];
+        int32_t *st = &f->state[4 * s];   // x[n-1], x[n-2], y[n-1], y[n-2]
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            int32_t x = src[i];
+            int64_t acc = (int64_t)c[0] * x + (int64_t)c[1] * st[0] + (int64_t)c[2] * st[1] +
+                          (int64_t)c[3] * st[2] + (int64_t)c[4] * st[3];
+            int32_t y = (int32_t)(acc >> (31 - f->post_shift));
+
+            st[1] = st[0];
+            st[0] = x;
+            st[3] = st[2];
+            st[2] = y;
+            out[i] = y;
+        }
+        // Later stages run in place on the output.
+        src = out;
+    }
+#endif
+    return n;
+}
+
+/*
+ * senlib_biquad_f32 - Filters n float samples.
+ */
+int senlib_biquad_f32 (struct senlib_biquad_f32 *f, const float *in, float *out, uint32_t n)
+{
+#ifdef CONFIG_CMSIS_DSP
+    arm_biquad_cascade_df2T_f32(&f->inst, (float32_t *)in, out, n);
+#else
+    const float *src = in;
+
+    for (int s = 0; s < f->stages; s++)
+    {
+        const float *c = &f->coeffs[5 * s];
+        float *st = &f->state[2 * s];
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            float x = src[i];
+            float y = c[0] * x + st[0];
+
+            st[0] = c[1] * x + c[3] * y + st[1];
+            st[1] = c[2] * x + c[4] * y;
+            out[i] = y;
+        }
+        src = out;
+    }
+#endif
+    return n;
+}
+
+struct senlib_accel_decim {
+    struct senlib_fir_q15 axis[3];
+    int16_t *coeffs;
+    int16_t *buf;               // Axis states, then one input and one output block
+};
+
+/*
+ * senlib_accel_decim_alloc - Allocates an accel decimator.
+ */
+struct senlib_accel_decim *senlib_accel_decim_alloc (uint16_t taps, uint8_t m, uint32_t fs_hz,
+                                                     uint16_t block)
+{
+    struct senlib_accel_decim *d;
+    uint32_t state = taps + block - 1;
+
+    if ((taps == 0) || (m == 0) || (block == 0) || (block % m))
+        return 0;
+
+    d = ard_malloc (sizeof (struct senlib_accel_decim));
+    if (d == 0)
+        return 0;
+    d->coeffs = ard_malloc (taps * sizeof (int16_t));
+    d->buf = ard_malloc ((3 * state + 2 * block) * sizeof (int16_t));
+    if ((d->coeffs == 0) || (d->buf == 0))
+    {
+        senlib_accel_decim_free (d);
+        return 0;
+    }
+
+    senlib_fir_lowpass_q15 (d->coeffs, taps, fs_hz * 4 / (10 * m), fs_hz);
+    for (int i = 0; i < 3; i++)
+        senlib_fir_q15_init (&d->axis[i], taps, m, d->coeffs, d->buf + i * state, block);
+    return d;
+}
+
+/*
+ * senlib_accel_decim_free - Frees an accel decimator.
+ */
+void senlib_accel_decim_free (struct senlib_accel_decim *d)
+{
+    if (d->coeffs)
+        ard_free (d->coeffs);
+    if (d->buf)
+        ard_free (d->buf);
+    ard_free (d);
+}
+
+/*
+ * senlib_accel_decim - Decimates a burst of accel samples.
+ */
+int senlib_accel_decim (struct senlib_accel_decim *d, const struct accel_fifo_sample *in,
+                        struct accel_fifo_sample *out, uint32_t n)
+{
+    struct senlib_fir_q15 *f = &d->axis[0];
+    int16_t *src = d->buf + 3 * (f->taps + f->block - 1);
+    int16_t *dst = src + f->block;
+    int outs = 0;
+
+    if (n % f->m)
+        return -EINVAL;
+
+    while (n)
+    {
+        uint32_t cnt = MIN(n, f->block);
+        uint32_t m = f->m;
+        int k;
+
+        // The kernels want one axis at a time. Outputs are written
+        // behind the inputs, so in place is fine.
+        for (int a = 0; a < 3; a++)
+        {
+            for (uint32_t i = 0; i < cnt; i++)
+                src[i] = (a == 0) ? in[i].x : (a == 1) ? in[i].y : in[i].z;
+            k = senlib_fir_q15 (&d->axis[a], src, dst, cnt);
+            for (int i = 0; i < k; i++)
+            {
+                if (a == 0)
+                    out[i].x = dst[i];
+                else if (a == 1)
+                    out[i].y = dst[i];
+                else
+                    out[i].z = dst[i];
+            }
+        }
+        for (uint32_t i = 0; i < cnt / m; i++)
+            out[i].timestamp = in[(i + 1) * m - 1].timestamp;
+
+        in += cnt;
+        out += cnt / m;
+        outs += cnt / m;
+        n -= cnt;
+    }
+    return outs;
+}
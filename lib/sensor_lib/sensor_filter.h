@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+#ifndef SENSOR_FILTER_H_
+#define SENSOR_FILTER_H_
+
+#include <zephyr/types.h>
+#include <accel_sensor.h>
+#ifdef CONFIG_CMSIS_DSP
+#include <arm_math.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Block filters for sensor streams. With CONFIG_CMSIS_DSP the CMSIS-DSP
+ * kernels are used. Without it, the same math runs in C, using the M33
+ * DSP multiply-accumulate instructions for q15 where the core has them.
+ *
+ * FIR coefficients are in CMSIS order, time reversed: coeffs[0] is
+ * applied to the oldest sample. Symmetric (linear phase) filters are
+ * the same either way. Biquad coefficients are {b0, b1, b2, a1, a2} per
+ * stage, with a1 and a2 negated as CMSIS expects.
+ */
+
+/**
+ * Decimating FIR, q15. Outputs one sample per m inputs.
+ * state needs taps + block - 1 entries.
+ */
+struct senlib_fir_q15 {
+#ifdef CONFIG_CMSIS_DSP
+    arm_fir_decimate_instance_q15 inst;
+#endif
+    uint16_t taps;
+    uint8_t m;
+    uint16_t block;             // Most inputs per call, a multiple of m
+    const int16_t *coeffs;
+    int16_t *state;
+};
+
+/**
+ * Decimating FIR, q31. Inputs may be milli-units. With coefficients
+ * summing to 1.0 (0x7FFFFFFF), the output has the same scale.
+ * state needs taps + block - 1 entries.
+ */
+struct senlib_fir_q31 {
+#ifdef CONFIG_CMSIS_DSP
+    arm_fir_decimate_instance_q31 inst;
+#endif
+    uint16_t taps;
+    uint8_t m;
+    uint16_t block;
+    const int32_t *coeffs;
+    int32_t *state;
+};
+
+/**
+ * Biquad cascade (direct form I), q31. Coefficients are scaled down by
+ * 2^post_shift so they fit. state needs 4 entries per stage.
+ */
+struct senlib_biquad_q31 {
+#ifdef CONFIG_CMSIS_DSP
+    arm_biquad_casd_df1_inst_q31 inst;
+#endif
+    uint8_t stages;
+    uint8_t post_shift;
+    const int32_t *coeffs;
+    int32_t *state;
+};
+
+/**
+ * Biquad cascade (direct form II transposed), float.
+ * state needs 2 entries per stage.
+ */
+struct senlib_biquad_f32 {
+#ifdef CONFIG_CMSIS_DSP
+    arm_biquad_cascade_df2T_instance_f32 inst;
+#endif
+    uint8_t stages;
+    const float *coeffs;
+    float *state;
+};
+
+/*
+ * Fills coeffs with a Hamming windowed sinc low-pass with cutoff at
+ * cutoff_hz for a rate of fs_hz. The gain at DC is 1. For decimation by
+ * m, a cutoff just below fs_hz / (2 * m) avoids aliasing.
+ */
+void senlib_fir_lowpass_q15 (int16_t *coeffs, uint16_t taps, uint32_t cutoff_hz, uint32_t fs_hz);
+void senlib_fir_lowpass_q31 (int32_t *coeffs, uint16_t taps, uint32_t cutoff_hz, uint32_t fs_hz);
+
+/*
+ * Sets up a filter. Returns 0 or -EINVAL if block isn't a multiple of m.
+ */
+int senlib_fir_q15_init (struct senlib_fir_q15 *f, uint16_t taps, uint8_t m,
+                         const int16_t *coeffs, int16_t *state, uint16_t block);
+int senlib_fir_q31_init (struct senlib_fir_q31 *f, uint16_t taps, uint8_t m,
+                         const int32_t *coeffs, int32_t *state, uint16_t block);
+void senlib_biquad_q31_init (struct senlib_biquad_q31 *f, uint8_t stages,
+                             const int32_t *coeffs, int32_t *state, uint8_t post_shift);
+void senlib_biquad_f32_init (struct senlib_biquad_f32 *f, uint8_t stages,
+                             const float *coeffs, float *state);
+
+/*
+ * Filters n samples. For the FIRs, n must be a multiple of m and they
+ * write n / m outputs. n may be larger than block; it is done in
+ * pieces. Returns the number of outputs.
+ */
+int senlib_fir_q15 (struct senlib_fir_q15 *f, const int16_t *in, int16_t *out, uint32_t n);
+int senlib_fir_q31 (struct senlib_fir_q31 *f, const int32_t *in, int32_t *out, uint32_t n);
+int senlib_biquad_q31 (struct senlib_biquad_q31 *f, const int32_t *in, int32_t *out, uint32_t n);
+int senlib_biquad_f32 (struct senlib_biquad_f32 *f, const float *in, float *out, uint32_t n);
+
+/*
+ * Low-pass and decimation of accel FIFO bursts, all three axes, with
+ * a taps long FIR designed for a cutoff at 0.8 * fs_hz / (2 * m). block
+ * is the largest burst in samples. 400 Hz down to 25 Hz is m = 16.
+ */
+struct senlib_accel_decim;
+
+struct senlib_accel_decim *senlib_accel_decim_alloc (uint16_t taps, uint8_t m, uint32_t fs_hz,
+                                                     uint16_t block);
+void senlib_accel_decim_free (struct senlib_accel_decim *d);
+
+/*
+ * Decimates n samples from in to out, which can be the same array.
+ * Each output has the timestamp of the last input it covers. n must
+ * be a multiple of m. Returns the number of outputs.
+ */
+int senlib_accel_decim (struct senlib_accel_decim *d, const struct accel_fifo_sample *in,
+                        struct accel_fifo_sample *out, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSOR_FILTER_H_ */
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * Software change detection for sensors without hardware thresholds.
+ * A channel is only reported when it moved further than a dead band
+ * from the value last reported, or crossed into another band.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+
+#include "sensor_limit.h"
+
+struct limit_chan {
+    struct senlib_limit_cfg cfg;
+    bool primed;                // Have a first value
+    uint8_t band;
+    int32_t ref;                // Value last reported
+};
+
+struct senlib_limits {
+    uint8_t channels;
+    struct limit_chan chan[];
+};
+
+//----------------------------------------------------
+// next_band - Band of x coming from band. Leaving a band needs the
+// value to get past the threshold, coming back in needs it to get
+// hysteresis inside.
+//----------------------------------------------------
+static uint8_t next_band(const struct senlib_limit_cfg *cfg, uint8_t band, int32_t x)
+{
+    if (x > cfg->high)
+        return SENLIB_BAND_HIGH;
+    if (x < cfg->low)
+        return SENLIB_BAND_LOW;
+    if ((band == SENLIB_BAND_HIGH) && (x > cfg->high - cfg->hysteresis))
+        return SENLIB_BAND_HIGH;
+    if ((band == SENLIB_BAND_LOW) && (x < cfg->low + cfg->hysteresis))
+        return SENLIB_BAND_LOW;
+    return SENLIB_BAND_NORMAL;
+}
+
+/*
+ * senlib_limits_alloc - Allocates change detection, all off.
+ */
+struct senlib_limits *senlib_limits_alloc (uint8_t channels)
+{
+    size_t size = sizeof (struct senlib_limits) + channels * sizeof (struct limit_chan);
+    struct senlib_limits *lim = ard_malloc (size);
+
+    if (lim)
+    {
+        memset (lim, 0, size);
+        lim->channels = channels;
+    }
+    return lim;
+}
+
+/*
+ * senlib_limits_setup - Sets up one channel.
+ */
+int senlib_limits_setup (struct senlib_limits *lim, const struct senlib_limit_cfg *cfg)
+{
+    if ((cfg->channel >= lim->channels) || (cfg->delta < 0) || (cfg->hysteresis < 0) ||
+        ((cfg->mode & SENLIB_LIMIT_BAND) && (cfg->low > cfg->high)))
+        return -EINVAL;
+
+    memset (&lim->chan[cfg->channel], 0, sizeof (struct limit_chan));
+    lim->chan[cfg->channel].cfg = *cfg;
+    return 0;
+}
+
+/*
+ * senlib_limits_get - Reads the setup of one channel.
+ */
+int senlib_limits_get (struct senlib_limits *lim, struct senlib_limit_cfg *cfg)
+{
+    if (cfg->channel >= lim->channels)
+        return -EINVAL;
+
+    *cfg = lim->chan[cfg->channel].cfg;
+    return 0;
+}
+
+/*
+ * senlib_limits_check - Checks one sample of every channel.
+ */
+int senlib_limits_check (struct senlib_limits *lim, const int32_t *val,
+                         struct senlib_limit_event *evt)
+{
+    int n = 0;
+
+    for (int i = 0; i < lim->channels; i++)
+    {
+        struct limit_chan *c = &lim->chan[i];
+        int32_t x = val[i];
+        int64_t diff;
+        uint8_t cause = 0;
+        uint8_t band;
+
+        if (c->cfg.mode == 0)
+            continue;
+
+        // The first value is the reference. Nothing to compare yet.
+        if (!c->primed)
+        {
+            c->primed = true;
+            c->ref = x;
+            c->band = SENLIB_BAND_NORMAL;
+            if (c->cfg.mode & SENLIB_LIMIT_BAND)
+                c->band = next_band (&c->cfg, SENLIB_BAND_NORMAL, x);
+            continue;
+        }
+
+        diff = (int64_t)x - c->ref;
+        if (diff < 0)
+            diff = -diff;
+        if ((c->cfg.mode & SENLIB_LIMIT_DELTA_ABS) && (diff > c->cfg.delta))
+            cause |= SENLIB_LIMIT_DELTA_ABS;
+        if ((c->cfg.mode & SENLIB_LIMIT_DELTA_REL) &&
+            (diff * 1000 > (int64_t)c->cfg.delta * ((c->ref < 0) ? -(int64_t)c->ref : c->ref)))
+            cause |= SENLIB_LIMIT_DELTA_REL;
+
+        band = c->band;
+        if (c->cfg.mode & SENLIB_LIMIT_BAND)
+        {
+            band = next_band (&c->cfg, c->band, x);
+            if (band != c->band)
+                cause |= SENLIB_LIMIT_BAND;
+        }
+
+        if (cause)
+        {
+            evt[n].channel = i;
+            evt[n].cause = cause;
+            evt[n].band = band;
+            evt[n].value = x;
+            evt[n].last = c->ref;
+            n++;
+            c->ref = x;
+            c->band = band;
+        }
+    }
+    return n;
+}
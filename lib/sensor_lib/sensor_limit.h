@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+#ifndef SENSOR_LIMIT_H_
+#define SENSOR_LIMIT_H_
+
+#include <zephyr/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Limit modes. Can be combined. */
+/* Report when the value moved more than delta from the last report */
+#define SENLIB_LIMIT_DELTA_ABS   0x01
+/* Report when the value moved more than delta per mille of the last report */
+#define SENLIB_LIMIT_DELTA_REL   0x02
+/* Report when the value leaves or comes back into [low, high] */
+#define SENLIB_LIMIT_BAND        0x04
+
+/* Bands reported in senlib_limit_event */
+#define SENLIB_BAND_LOW          0
+#define SENLIB_BAND_NORMAL       1
+#define SENLIB_BAND_HIGH         2
+
+/**
+ * Change detection set up for one channel. Values are in the
+ * channel's milli-units. Used with ARDCONFIG_SETLIMIT and
+ * ARDCONFIG_GETLIMIT. mode 0 turns it off.
+ */
+struct senlib_limit_cfg {
+    uint8_t channel;            // Index in the sensor's channels
+    uint8_t mode;               // SENLIB_LIMIT_xxx
+    int32_t delta;              // Dead band, absolute or per mille
+    int32_t low;
+    int32_t high;
+    // Distance a value has to come back inside the band before it
+    // counts as normal again, so noise at a threshold reports once.
+    int32_t hysteresis;
+};
+
+/**
+ * Passed with ARDCB_CHANGED when a channel changed.
+ */
+struct senlib_limit_event {
+    uint8_t channel;
+    uint8_t cause;              // SENLIB_LIMIT_xxx that fired
+    uint8_t band;               // SENLIB_BAND_xxx the value is in
+    int32_t value;
+    int32_t last;               // Value at the previous report
+};
+
+struct senlib_limits;
+
+/*
+ * Allocates change detection for channels channels, all off.
+ */
+struct senlib_limits *senlib_limits_alloc (uint8_t channels);
+
+/*
+ * Sets up one channel. Detection starts over from the next sample.
+ */
+int senlib_limits_setup (struct senlib_limits *lim, const struct senlib_limit_cfg *cfg);
+
+/*
+ * Reads the setup of cfg->channel.
+ */
+int senlib_limits_get (struct senlib_limits *lim, struct senlib_limit_cfg *cfg);
+
+/*
+ * Checks one sample of all channels. Writes an event for each channel
+ * that should be reported to evt, room for one per channel. Returns
+ * the number of events.
+ */
+int senlib_limits_check (struct senlib_limits *lim, const int32_t *val,
+                         struct senlib_limit_event *evt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSOR_LIMIT_H_ */
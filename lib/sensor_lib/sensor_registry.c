@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * Sensor instances.
+ *
+ * The table is built from the devicetree, one entry for each enabled
+ * node of the parts the library supports, and holds the sample
+ * storage of each instance, so two handles never share a buffer.
+ * Drivers without a node, such as the emulated sensors on
+ * native_posix, get one of the extra slots when opened by label.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+
+#include "sensor_registry.h"
+
+#define REG_OKAY(inst, compat)  DT_NODE_HAS_STATUS(DT_INST(inst, compat), okay)
+
+#define REG_ENTRY(inst, compat, t)                          \
+    {                                                       \
+        .label = DT_LABEL(DT_INST(inst, compat)),           \
+        .type = t,                                          \
+    },
+
+// Up to two of each part
+#define REG_DT_COUNT    (REG_OKAY(0, adi_adxl362) + REG_OKAY(1, adi_adxl362) +   \
+                         REG_OKAY(0, adi_adxl372) + REG_OKAY(1, adi_adxl372) +   \
+                         REG_OKAY(0, bosch_bme680) + REG_OKAY(1, bosch_bme680))
+
+static struct senlib_reg_entry reg_table[REG_DT_COUNT + CONFIG_SENLIB_REGISTRY_EXTRA] = {
+#if REG_OKAY(0, adi_adxl362)
+    REG_ENTRY(0, adi_adxl362, SENLIB_REG_ACCEL)
+#endif
+#if REG_OKAY(1, adi_adxl362)
+    REG_ENTRY(1, adi_adxl362, SENLIB_REG_ACCEL)
+#endif
+#if REG_OKAY(0, adi_adxl372)
+    REG_ENTRY(0, adi_adxl372, SENLIB_REG_ACCEL)
+#endif
+#if REG_OKAY(1, adi_adxl372)
+    REG_ENTRY(1, adi_adxl372, SENLIB_REG_ACCEL)
+#endif
+#if REG_OKAY(0, bosch_bme680)
+    REG_ENTRY(0, bosch_bme680, SENLIB_REG_ENV)
+#endif
+#if REG_OKAY(1, bosch_bme680)
+    REG_ENTRY(1, bosch_bme680, SENLIB_REG_ENV)
+#endif
+};
+
+// Labels of the extra slots, which may come from the caller's stack.
+static char reg_extra_labels[CONFIG_SENLIB_REGISTRY_EXTRA][16];
+
+static K_MUTEX_DEFINE(reg_lock);
+
+/*
+ * senlib_reg_count - Returns the number of ids.
+ */
+int senlib_reg_count (void)
+{
+    return ARRAY_SIZE(reg_table);
+}
+
+/*
+ * senlib_reg_get - Returns the instance with the given id.
+ */
+struct senlib_reg_entry *senlib_reg_get (int id)
+{
+    if ((id < 0) || (id >= ARRAY_SIZE(reg_table)) || (reg_table[id].label == 0))
+        return 0;
+    return &reg_table[id];
+}
+
+/*
+ * senlib_reg_next - Returns the id of the next instance of type.
+ */
+int senlib_reg_next (int id, uint8_t type)
+{
+    for (id = MAX(id + 1, 0); id < ARRAY_SIZE(reg_table); id++)
+    {
+        if (reg_table[id].label && (reg_table[id].type == type))
+            return id;
+    }
+    return -ENODEV;
+}
+
+/*
+ * senlib_reg_find - Returns the id of the instance with the label.
+ */
+int senlib_reg_find (const char *label)
+{
+    for (int id = 0; id < ARRAY_SIZE(reg_table); id++)
+    {
+        if (reg_table[id].label && (strcmp (reg_table[id].label, label) == 0))
+            return id;
+    }
+    return -ENODEV;
+}
+
+/*
+ * senlib_reg_open - Marks an instance open.
+ */
+struct senlib_reg_entry *senlib_reg_open (const char *label, uint8_t type, int *prc)
+{
+    struct senlib_reg_entry *entry = 0;
+    int id;
+
+    if ((label == 0) || (strlen (label) >= sizeof (reg_extra_labels[0])))
+    {
+        *prc = -EINVAL;
+        return 0;
+    }
+
+    k_mutex_lock(&reg_lock, K_FOREVER);
+    id = senlib_reg_find (label);
+    if (id < 0)
+    {
+        // Not in the devicetree, take a free extra slot.
+        for (id = REG_DT_COUNT; id < ARRAY_SIZE(reg_table); id++)
+        {
+            if (reg_table[id].label == 0)
+            {
+                char *name = reg_extra_labels[id - REG_DT_COUNT];
+
+                strcpy (name, label);
+                reg_table[id].label = name;
+                reg_table[id].type = type;
+                break;
+            }
+        }
+    }
+    if (id >= ARRAY_SIZE(reg_table))
+        *prc = -ENOMEM;
+    else if (reg_table[id].type != type)
+        *prc = -EINVAL;
+    else if (reg_table[id].open)
+        *prc = -EBUSY;
+    else
+    {
+        entry = &reg_table[id];
+        entry->open = true;
+        memset (entry->raw, 0, sizeof (entry->raw));
+    }
+    k_mutex_unlock(&reg_lock);
+    return entry;
+}
+
+/*
+ * senlib_reg_close - Closes an instance. Extra slots are freed.
+ */
+void senlib_reg_close (struct senlib_reg_entry *entry)
+{
+    k_mutex_lock(&reg_lock, K_FOREVER);
+    entry->open = false;
+    if ((entry - reg_table) >= REG_DT_COUNT)
+        entry->label = 0;
+    k_mutex_unlock(&reg_lock);
+}
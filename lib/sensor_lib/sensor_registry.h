@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+#ifndef SENSOR_REGISTRY_H_
+#define SENSOR_REGISTRY_H_
+
+#include <zephyr/types.h>
+#include <drivers/sensor.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_REGISTRY_EXTRA
+#define CONFIG_SENLIB_REGISTRY_EXTRA 2
+#endif //CONFIG_SENLIB_REGISTRY_EXTRA
+
+// Channels kept per instance
+#define SENLIB_REG_MAX_CHANNELS     3
+
+/* Kinds of sensor */
+#define SENLIB_REG_ACCEL        0
+#define SENLIB_REG_ENV          1
+
+/**
+ * One sensor instance. The ids are the table index: the devicetree
+ * instances first, in the order of the parts below, then the extra
+ * slots for drivers without a devicetree node.
+ */
+struct senlib_reg_entry {
+    const char *label;          // Device label, 0 for a free extra slot
+    uint8_t type;               // SENLIB_REG_xxx
+    bool open;
+    // Sample storage of the instance, passed to senlib_init as raw_data
+    struct sensor_value raw[SENLIB_REG_MAX_CHANNELS];
+};
+
+/*
+ * Returns the number of ids, including free extra slots.
+ */
+int senlib_reg_count (void);
+
+/*
+ * Returns the instance with the given id, 0 if there is none.
+ */
+struct senlib_reg_entry *senlib_reg_get (int id);
+
+/*
+ * Returns the id of the next instance of type after id, or -ENODEV.
+ * Start with -1.
+ */
+int senlib_reg_next (int id, uint8_t type);
+
+/*
+ * Returns the id of the instance with the label, or -ENODEV.
+ */
+int senlib_reg_find (const char *label);
+
+/*
+ * Marks an instance open and returns it. A label that isn't in the
+ * devicetree takes an extra slot. Fails with -EBUSY if the instance
+ * is already open.
+ */
+struct senlib_reg_entry *senlib_reg_open (const char *label, uint8_t type, int *prc);
+
+/*
+ * Closes an instance opened with senlib_reg_open.
+ */
+void senlib_reg_close (struct senlib_reg_entry *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSOR_REGISTRY_H_ */
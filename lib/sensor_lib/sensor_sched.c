@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * Synchronized multi-sensor acquisition.
+ *
+ * The scheduler ticks at the greatest common divisor of the sensor
+ * periods. On each tick the sensors that are due are read in
+ * parallel on a small pool of fetch queues. Zephyr sensor fetches
+ * block for the whole conversion, so reads on different queues
+ * overlap: the slowest sensors are started first, each on the queue
+ * with the least expected work, and the fast ones fill in around
+ * them. The cycle ends when the last read is done, which keeps the
+ * time the system is awake per cycle close to the slowest sensor
+ * rather than the sum of all of them.
+ *
+ * The tick itself only starts the reads and never waits for them:
+ * the last read of a cycle completes the record and reports it from
+ * its fetch queue. A read still running at the next tick is an error
+ * in its own cycle, and its sensor is skipped until it is done.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+
+#include "sensor_sched.h"
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_SCHED_THREADS
+#define CONFIG_SENLIB_SCHED_THREADS 2
+#endif //CONFIG_SENLIB_SCHED_THREADS
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_SCHED_STACK_SIZE
+#define CONFIG_SENLIB_SCHED_STACK_SIZE 1536
+#endif //CONFIG_SENLIB_SCHED_STACK_SIZE
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_WORKQ_PRIORITY
+#define CONFIG_SENLIB_WORKQ_PRIORITY 5
+#endif //CONFIG_SENLIB_WORKQ_PRIORITY
+
+struct sched_entry {
+    void *lib;
+    uint32_t period_ms;
+    uint32_t div;               // Read every div ticks
+    uint8_t channels;
+    uint32_t est_us;            // Running average of the read time
+    uint32_t cycle;             // Cycle the read was started in
+    atomic_t busy;              // Read started and not yet done
+    struct k_work work;
+};
+
+static struct sched_entry entries[CONFIG_SENLIB_SCHED_MAX_SENSORS];
+static int entry_cnt;
+
+static K_THREAD_STACK_ARRAY_DEFINE(sched_stacks, CONFIG_SENLIB_SCHED_THREADS,
+                                   CONFIG_SENLIB_SCHED_STACK_SIZE);
+static struct k_work_q sched_queues[CONFIG_SENLIB_SCHED_THREADS];
+static bool sched_queues_started = false;
+
+static struct k_timer sched_timer;
+static struct k_work sched_cycle_work;
+static bool sched_running = false;
+static uint32_t sched_tick_ms;
+static uint32_t sched_tick;
+
+// The open cycle, guarded by sched_lock.
+static struct k_spinlock sched_lock;
+static bool sched_open = false;
+static uint32_t sched_cycle_no;
+static int sched_left;          // Reads still out
+
+static struct senlib_sched_record sched_rec;
+static struct senlib_sched_stats sched_stats;
+static SenLib_sched_fn sched_fn;
+static uint32_t sched_userdata;
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static uint32_t now_us(void)
+{
+    return (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+/*
+ * sched_close - Completes the open cycle into rec. Called with
+ * sched_lock held.
+ */
+static void sched_close(struct senlib_sched_record *rec)
+{
+    sched_open = false;
+    sched_rec.awake_us = now_us() - sched_rec.timestamp;
+
+    sched_stats.cycles++;
+    sched_stats.awake_sum_us += sched_rec.awake_us;
+    if (sched_rec.awake_us > sched_stats.awake_max_us)
+        sched_stats.awake_max_us = sched_rec.awake_us;
+
+    memcpy(rec, &sched_rec, sizeof (struct senlib_sched_record));
+}
+
+static void sched_report(const struct senlib_sched_record *rec)
+{
+    if (sched_running && sched_fn)
+        (sched_fn)(rec, sched_userdata);
+}
+
+/*
+ * sched_read_work - Reads one sensor on a fetch queue.
+ */
+static void sched_read_work(struct k_work *work)
+{
+    struct sched_entry *e = CONTAINER_OF(work, struct sched_entry, work);
+    int idx = e - entries;
+    int32_t val[SENLIB_SCHED_MAX_CHANNELS];
+    struct senlib_sched_record rec;
+    k_spinlock_key_t key;
+    bool done = false;
+    uint32_t start = k_cycle_get_32();
+    uint32_t us;
+    int rc;
+
+    rc = senlib_readsensor_milli(e->lib, val, e->channels * sizeof (int32_t));
+
+    // Weight the newest read by 1/4.
+    us = (uint32_t)k_cyc_to_us_floor64(k_cycle_get_32() - start);
+    e->est_us = (e->est_us == 0) ? us : (e->est_us * 3 + us) / 4;
+
+    key = k_spin_lock(&sched_lock);
+    // A late read's cycle has already been reported.
+    if (sched_open && (e->cycle == sched_cycle_no))
+    {
+        if (rc > 0)
+            memcpy(sched_rec.val[idx], val, e->channels * sizeof (int32_t));
+        else
+            sched_rec.error_mask |= BIT(idx);
+        if (--sched_left == 0)
+        {
+            sched_close(&rec);
+            done = true;
+        }
+    }
+    atomic_clear(&e->busy);
+    k_spin_unlock(&sched_lock, key);
+
+    if (done)
+        sched_report(&rec);
+}
+
+/*
+ * sched_cycle - Starts one tick on the sensor work queue.
+ */
+static void sched_cycle(struct k_work *work)
+{
+    uint8_t order[CONFIG_SENLIB_SCHED_MAX_SENSORS];
+    uint32_t load[CONFIG_SENLIB_SCHED_THREADS] = { 0 };
+    uint8_t queue[CONFIG_SENLIB_SCHED_MAX_SENSORS];
+    struct senlib_sched_record rec;
+    k_spinlock_key_t key;
+    bool done = false;
+    int n = 0, i, j, q;
+
+    if (!sched_running)
+        return;
+
+    // More than one expiry means the last cycle ran over.
+    i = k_timer_status_get(&sched_timer);
+    if (i > 1)
+        sched_stats.overruns += i - 1;
+    sched_tick++;
+
+    // Reads still out from the last cycle fail it.
+    key = k_spin_lock(&sched_lock);
+    if (sched_open)
+    {
+        for (i = 0; i < entry_cnt; i++)
+        {
+            if (atomic_get(&entries[i].busy) && (entries[i].cycle == sched_cycle_no))
+            {
+                sched_rec.error_mask |= BIT(i);
+                sched_stats.late_reads++;
+            }
+        }
+        sched_close(&rec);
+        done = true;
+    }
+    k_spin_unlock(&sched_lock, key);
+
+    if (done)
+        sched_report(&rec);
+    done = false;
+
+    key = k_spin_lock(&sched_lock);
+    sched_cycle_no++;
+    sched_rec.timestamp = now_us();
+    sched_rec.mask = 0;
+    sched_rec.error_mask = 0;
+
+    // Due sensors, slowest first. Those still busy are skipped.
+    for (i = 0; i < entry_cnt; i++)
+    {
+        if (sched_tick % entries[i].div)
+            continue;
+        sched_rec.mask |= BIT(i);
+        if (atomic_get(&entries[i].busy))
+        {
+            sched_rec.error_mask |= BIT(i);
+            continue;
+        }
+        for (j = n; (j > 0) && (entries[order[j - 1]].est_us < entries[i].est_us); j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+        n++;
+    }
+
+    // Each on the queue with the least expected work so far.
+    for (i = 0; i < n; i++)
+    {
+        struct sched_entry *e = &entries[order[i]];
+
+        for (q = 0, j = 1; j < CONFIG_SENLIB_SCHED_THREADS; j++)
+        {
+            if (load[j] < load[q])
+                q = j;
+        }
+        load[q] += e->est_us + 1;
+        queue[i] = q;
+        e->cycle = sched_cycle_no;
+        atomic_set(&e->busy, 1);
+    }
+
+    sched_left = n;
+    if (sched_rec.mask)
+    {
+        sched_open = true;
+        // Every due sensor was still busy.
+        if (n == 0)
+        {
+            sched_close(&rec);
+            done = true;
+        }
+    }
+    k_spin_unlock(&sched_lock, key);
+
+    if (done)
+        sched_report(&rec);
+
+    for (i = 0; i < n; i++)
+    {
+        k_work_submit_to_queue(&sched_queues[queue[i]], &entries[order[i]].work);
+    }
+}
+
+static void sched_timer_expiry(struct k_timer *timer)
+{
+    senlib_submit(&sched_cycle_work);
+}
+
+/*
+ * senlib_sched_add - Adds a sensor to the schedule.
+ */
+int senlib_sched_add (void *lib_in, uint32_t period_ms)
+{
+    struct sched_entry *e;
+
+    if ((lib_in == 0) || (period_ms == 0))
+        return -EINVAL;
+    if (senlib_getsensor(lib_in)->no_of_channels > SENLIB_SCHED_MAX_CHANNELS)
+        return -ENOTSUP;
+    if (sched_running)
+        return -EBUSY;
+    if (entry_cnt >= CONFIG_SENLIB_SCHED_MAX_SENSORS)
+        return -ENOMEM;
+    // A read from before the stop may still be running.
+    if (atomic_get(&entries[entry_cnt].busy))
+        return -EBUSY;
+
+    e = &entries[entry_cnt];
+    memset(e, 0, sizeof (struct sched_entry));
+    e->lib = lib_in;
+    e->channels = senlib_getsensor(lib_in)->no_of_channels;
+    e->period_ms = period_ms;
+    k_work_init(&e->work, sched_read_work);
+    return entry_cnt++;
+}
+
+/*
+ * senlib_sched_clear - Removes all sensors.
+ */
+void senlib_sched_clear (void)
+{
+    if (!sched_running)
+        entry_cnt = 0;
+}
+
+/*
+ * senlib_sched_start - Starts the schedule.
+ */
+int senlib_sched_start (SenLib_sched_fn fn, uint32_t userdata)
+{
+    k_spinlock_key_t key;
+    int i;
+
+    if (entry_cnt == 0)
+        return -EINVAL;
+    if (sched_running)
+        return -EALREADY;
+
+    if (!sched_queues_started)
+    {
+        sched_queues_started = true;
+        for (i = 0; i < CONFIG_SENLIB_SCHED_THREADS; i++)
+        {
+            k_work_q_start(&sched_queues[i], sched_stacks[i],
+                           K_THREAD_STACK_SIZEOF(sched_stacks[i]),
+                           CONFIG_SENLIB_WORKQ_PRIORITY);
+        }
+        k_work_init(&sched_cycle_work, sched_cycle);
+        k_timer_init(&sched_timer, sched_timer_expiry, NULL);
+    }
+
+    // Tick at the common divisor of the periods.
+    sched_tick_ms = 0;
+    for (i = 0; i < entry_cnt; i++)
+    {
+        sched_tick_ms = gcd(sched_tick_ms, entries[i].period_ms);
+    }
+    for (i = 0; i < entry_cnt; i++)
+    {
+        entries[i].div = entries[i].period_ms / sched_tick_ms;
+    }
+
+    // A cycle left open by the stop is not reported.
+    key = k_spin_lock(&sched_lock);
+    sched_open = false;
+    k_spin_unlock(&sched_lock, key);
+
+    memset(&sched_stats, 0, sizeof (sched_stats));
+    sched_fn = fn;
+    sched_userdata = userdata;
+    // The first tick reads every sensor.
+    sched_tick = (uint32_t)-1;
+    sched_running = true;
+    k_timer_start(&sched_timer, K_NO_WAIT, K_MSEC(sched_tick_ms));
+    return 0;
+}
+
+struct sched_flush_work {
+    struct k_work work;
+    struct k_sem done;
+};
+
+static void sched_flush_handler(struct k_work *work)
+{
+    struct sched_flush_work *fw = CONTAINER_OF(work, struct sched_flush_work, work);
+
+    k_sem_give(&fw->done);
+}
+
+/*
+ * senlib_sched_stop - Stops the schedule and waits for the reads
+ * already started.
+ */
+int senlib_sched_stop (void)
+{
+    struct sched_flush_work fw[CONFIG_SENLIB_SCHED_THREADS];
+    int i;
+
+    if (!sched_queues_started)
+        return 0;
+    for (i = 0; i < CONFIG_SENLIB_SCHED_THREADS; i++)
+    {
+        if (k_current_get() == &sched_queues[i].thread)
+            return -EDEADLK;
+    }
+
+    sched_running = false;
+    k_timer_stop(&sched_timer);
+
+    // A tick already running may still start reads. On the sensor
+    // work queue itself there is none.
+    senlib_flush();
+
+    // Each fetch queue runs its work in order, so once the sentinel
+    // has run the reads queued before it are done.
+    for (i = 0; i < CONFIG_SENLIB_SCHED_THREADS; i++)
+    {
+        k_work_init(&fw[i].work, sched_flush_handler);
+        k_sem_init(&fw[i].done, 0, 1);
+        k_work_submit_to_queue(&sched_queues[i], &fw[i].work);
+    }
+    for (i = 0; i < CONFIG_SENLIB_SCHED_THREADS; i++)
+    {
+        k_sem_take(&fw[i].done, K_FOREVER);
+    }
+    return 0;
+}
+
+/*
+ * senlib_sched_get_stats - Copies the scheduler counters.
+ */
+void senlib_sched_get_stats (struct senlib_sched_stats *stats)
+{
+    memcpy(stats, &sched_stats, sizeof (struct senlib_sched_stats));
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+#ifndef SENSOR_SCHED_H_
+#define SENSOR_SCHED_H_
+
+#include <zephyr/types.h>
+#include "sensor_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SENLIB_SCHED_MAX_SENSORS
+#define CONFIG_SENLIB_SCHED_MAX_SENSORS 8
+#endif //CONFIG_SENLIB_SCHED_MAX_SENSORS
+
+// Channels kept per sensor in a record.
+#define SENLIB_SCHED_MAX_CHANNELS   4
+
+/**
+ * One acquisition cycle. All sensors due in the cycle are started
+ * together, so their values share the cycle's timestamp.
+ */
+struct senlib_sched_record {
+    uint32_t timestamp;         // us since boot when the cycle started
+    uint32_t mask;              // Bit n set if sensor n was read
+    uint32_t error_mask;        // Bit n set if reading sensor n failed, or
+                                // it was skipped because its last read
+                                // was still running
+    uint32_t awake_us;          // Time from the start to the last read done
+    // Milli-units, as senlib_readsensor_milli
+    int32_t val[CONFIG_SENLIB_SCHED_MAX_SENSORS][SENLIB_SCHED_MAX_CHANNELS];
+};
+
+/**
+ * @brief Called with each record, on the fetch queue that did the
+ * cycle's last read, or on the sensor work queue if the cycle ran
+ * into the next tick, so records can come from different threads.
+ */
+typedef void (*SenLib_sched_fn)(const struct senlib_sched_record *rec, uint32_t userdata);
+
+/**
+ * Scheduler counters.
+ */
+struct senlib_sched_stats {
+    uint32_t cycles;
+    uint32_t overruns;          // Ticks lost because the sensor work queue was busy
+    uint32_t late_reads;        // Reads still running at the next tick
+    uint32_t awake_max_us;
+    uint32_t awake_sum_us;      // Divide by cycles for the mean
+};
+
+/*
+ * Adds a sensor handle read every period_ms. Returns the sensor's
+ * index in the records or a negative error. The scheduler must be
+ * stopped.
+ */
+int senlib_sched_add (void *lib_in, uint32_t period_ms);
+
+/*
+ * Removes all sensors. The scheduler must be stopped.
+ */
+void senlib_sched_clear (void);
+
+/*
+ * Starts acquisition. fn is called with a record for every cycle
+ * in which at least one sensor is due.
+ */
+int senlib_sched_start (SenLib_sched_fn fn, uint32_t userdata);
+
+/*
+ * Stops acquisition and waits for the reads already started. The
+ * sensor handles may only be deinitialized once it has returned 0.
+ * Returns -EDEADLK, without stopping, when called from a record
+ * callback running on a fetch queue.
+ */
+int senlib_sched_stop (void);
+
+/*
+ * Copies the scheduler counters.
+ */
+void senlib_sched_get_stats (struct senlib_sched_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSOR_SCHED_H_ */
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * Vibration spectrum features.
+ *
+ * Samples are collected into windows of fft_len. Each window has its
+ * mean removed, is scaled up to use the q15 range (block floating
+ * point), Hann windowed and run through a real FFT in q15. With
+ * CONFIG_CMSIS_DSP that is arm_rfft_q15, otherwise a radix-2 FFT in C
+ * with the same scaling: the output is the DFT divided by fft_len.
+ *
+ * The features are worked out from the power spectrum in float, on
+ * the M33 FPU when CONFIG_FPU is set. Only the window and the
+ * spectrum need the fixed point path.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+#include <math.h>
+#ifdef CONFIG_CMSIS_DSP
+#include <arm_math.h>
+#endif
+
+#include "sensor_common.h"
+#include "sensor_spectrum.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Mean square of the Hann window. Energy lost to the window.
+#define HANN_POWER_GAIN     0.375f
+
+struct senlib_spectrum {
+    struct senlib_spectrum_cfg cfg;
+#ifdef CONFIG_CMSIS_DSP
+    arm_rfft_instance_q15 rfft;
+#else
+    int16_t *twiddle;           // cos, -sin pairs for fft_len / 2 angles
+#endif
+    int16_t *hann;
+    int16_t *in;                // Window being collected
+    int16_t *work;              // Windowed input, then the spectrum
+    uint32_t fill;
+    uint32_t skip;              // Samples to drop before the next window
+    uint32_t period_us;
+};
+
+#ifndef CONFIG_CMSIS_DSP
+//----------------------------------------------------
+// fft_q15 - In place radix-2 FFT of n complex q15 values, halved
+// every stage so it can't overflow.
+//----------------------------------------------------
+static void fft_q15(const int16_t *tw, int16_t *x, uint32_t n)
+{
+    uint32_t i, j, k, len;
+
+    // Bit reverse
+    for (i = 1, j = 0; i < n; i++)
+    {
+        uint32_t bit = n >> 1;
+
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+        {
+            int16_t re = x[2 * i], im = x[2 * i + 1];
+
+            x[2 * i] = x[2 * j];
+            x[2 * i + 1] = x[2 * j + 1];
+            x[2 * j] = re;
+            x[2 * j + 1] = im;
+        }
+    }
+
+    for (len = 2; len <= n; len <<= 1)
+    {
+        uint32_t step = n / len;
+
+        for (i = 0; i < n; i += len)
+        {
+            for (k = 0; k < len / 2; k++)
+            {
+                int16_t *a = &x[2 * (i + k)];
+                int16_t *b = &x[2 * (i + k + len / 2)];
+                int32_t wr = tw[2 * k * step], wi = tw[2 * k * step + 1];
+                int32_t tr = (b[0] * wr - b[1] * wi) >> 15;
+                int32_t ti = (b[0] * wi + b[1] * wr) >> 15;
+
+                b[0] = (a[0] - tr) >> 1;
+                b[1] = (a[1] - ti) >> 1;
+                a[0] = (a[0] + tr) >> 1;
+                a[1] = (a[1] + ti) >> 1;
+            }
+        }
+    }
+}
+#endif
+
+//----------------------------------------------------
+// spectrum_run - Works out the features of the collected window.
+//----------------------------------------------------
+static void spectrum_run(struct senlib_spectrum *sp, uint32_t timestamp)
+{
+    struct senlib_spectrum_features feat;
+    uint32_t n = sp->cfg.fft_len;
+    int16_t *spec;
+    int32_t sum = 0, mean, peak = 0;
+    int64_t ss = 0;
+    float scale, pmax = 0, power = 0;
+    uint32_t kmax = 0;
+    int shift = 0;
+
+    memset (&feat, 0, sizeof (feat));
+    feat.timestamp = timestamp;
+    feat.bands = sp->cfg.bands;
+
+    // Time domain
+    for (uint32_t i = 0; i < n; i++)
+        sum += sp->in[i];
+    mean = sum / (int32_t)n;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        int32_t d = sp->in[i] - mean;
+
+        peak = MAX(peak, (d < 0) ? -d : d);
+        ss += (int64_t)d * d;
+    }
+    feat.rms = (uint16_t)MIN(lroundf(sqrtf((float)ss / n)), UINT16_MAX);
+    feat.peak = (uint16_t)MIN(peak, UINT16_MAX);
+    feat.crest = feat.rms ? (uint16_t)MIN(lroundf(100.0f * peak / sqrtf((float)ss / n)), UINT16_MAX) : 0;
+
+    if (peak == 0)
+        goto done;
+
+    // Scale up so small vibrations keep their resolution.
+    while ((shift < 14) && ((peak << (shift + 1)) < 0x4000))
+        shift++;
+    for (uint32_t i = 0; i < n; i++)
+        sp->work[i] = (int16_t)((((sp->in[i] - mean) << shift) * sp->hann[i]) >> 15);
+
+#ifdef CONFIG_CMSIS_DSP
+    spec = sp->work + n;
+    arm_rfft_q15(&sp->rfft, sp->work, spec);
+#else
+    // Real input as complex, from the top down so it can be in place
+    for (int32_t i = n - 1; i >= 0; i--)
+    {
+        sp->work[2 * i] = sp->work[i];
+        sp->work[2 * i + 1] = 0;
+    }
+    spec = sp->work;
+    fft_q15(sp->twiddle, spec, n);
+#endif
+
+    // Power of bin k is p * n^2 / 4^shift. A sine of amplitude A
+    // shows as A * n / 4 with the Hann window.
+    scale = 1.0f / (1 << shift);
+    for (uint32_t k = 1; k < n / 2; k++)
+    {
+        float p = (float)spec[2 * k] * spec[2 * k] + (float)spec[2 * k + 1] * spec[2 * k + 1];
+
+        if (p > pmax)
+        {
+            pmax = p;
+            kmax = k;
+        }
+    }
+    if (kmax)
+    {
+        float m0 = sqrtf((float)spec[2 * kmax - 2] * spec[2 * kmax - 2] +
+                         (float)spec[2 * kmax - 1] * spec[2 * kmax - 1]);
+        float m1 = sqrtf(pmax);
+        float m2 = sqrtf((float)spec[2 * kmax + 2] * spec[2 * kmax + 2] +
+                         (float)spec[2 * kmax + 3] * spec[2 * kmax + 3]);
+        float den = m0 - 2 * m1 + m2;
+        // Parabola through the peak and its neighbours
+        float delta = (den != 0) ? 0.5f * (m0 - m2) / den : 0;
+
+        feat.peak_dhz = (uint16_t)MIN(lroundf((kmax + delta) * sp->cfg.fs_hz * 10.0f / n), UINT16_MAX);
+        feat.peak_amp = (uint16_t)MIN(lroundf(4 * m1 * scale), UINT16_MAX);
+    }
+
+    // Band RMS from Parseval, one sided so twice the bin power
+    for (int b = 0; b < sp->cfg.bands; b++)
+    {
+        uint32_t lo = (sp->cfg.band_edge_hz[b] * n + sp->cfg.fs_hz / 2) / sp->cfg.fs_hz;
+        uint32_t hi = (sp->cfg.band_edge_hz[b + 1] * n + sp->cfg.fs_hz / 2) / sp->cfg.fs_hz;
+
+        power = 0;
+        for (uint32_t k = MAX(lo, 1); (k < hi) && (k <= n / 2); k++)
+            power += (float)spec[2 * k] * spec[2 * k] + (float)spec[2 * k + 1] * spec[2 * k + 1];
+        feat.band_rms[b] = (uint16_t)MIN(lroundf(sqrtf(2 * power / HANN_POWER_GAIN) * scale), UINT16_MAX);
+    }
+
+done:
+    if (sp->cfg.fn)
+        (sp->cfg.fn)(ARDCB_DATAREADY, &feat, sizeof (feat), sp->cfg.userdata);
+}
+
+/*
+ * senlib_spectrum_alloc - Allocates spectrum analysis.
+ */
+struct senlib_spectrum *senlib_spectrum_alloc (const struct senlib_spectrum_cfg *cfg)
+{
+    struct senlib_spectrum *sp;
+    uint32_t n = cfg->fft_len;
+    size_t size;
+
+    if ((n < SENLIB_SPECTRUM_MIN_LEN) || (n > SENLIB_SPECTRUM_MAX_LEN) || (n & (n - 1)) ||
+        (cfg->fs_hz == 0) || (cfg->bands > SENLIB_SPECTRUM_BANDS))
+        return 0;
+    for (int b = 0; b < cfg->bands; b++)
+    {
+        if (cfg->band_edge_hz[b] >= cfg->band_edge_hz[b + 1])
+            return 0;
+    }
+
+    // Window, input and work (3n) in one block after the state.
+    // Without CMSIS-DSP, n more for the twiddles.
+    size = sizeof (struct senlib_spectrum) + 5 * n * sizeof (int16_t);
+#ifndef CONFIG_CMSIS_DSP
+    size += n * sizeof (int16_t);
+#endif
+    sp = ard_malloc (size);
+    if (sp == 0)
+        return 0;
+
+    memset (sp, 0, sizeof (struct senlib_spectrum));
+    sp->cfg = *cfg;
+    if (sp->cfg.hop == 0)
+        sp->cfg.hop = n;
+    sp->period_us = 1000000 / cfg->fs_hz;
+    sp->hann = (int16_t *)(sp + 1);
+    sp->in = sp->hann + n;
+    sp->work = sp->in + n;
+    for (uint32_t i = 0; i < n; i++)
+        sp->hann[i] = (int16_t)lroundf(32767 * 0.5f * (1 - cosf(2 * (float)M_PI * i / n)));
+
+#ifdef CONFIG_CMSIS_DSP
+    if (arm_rfft_init_q15(&sp->rfft, n, 0, 1) != ARM_MATH_SUCCESS)
+    {
+        ard_free (sp);
+        return 0;
+    }
+#else
+    sp->twiddle = sp->work + 3 * n;
+    for (uint32_t k = 0; k < n / 2; k++)
+    {
+        sp->twiddle[2 * k] = (int16_t)lroundf(32767 * cosf(2 * (float)M_PI * k / n));
+        sp->twiddle[2 * k + 1] = (int16_t)lroundf(-32767 * sinf(2 * (float)M_PI * k / n));
+    }
+#endif
+    return sp;
+}
+
+/*
+ * senlib_spectrum_free - Frees spectrum analysis.
+ */
+void senlib_spectrum_free (struct senlib_spectrum *sp)
+{
+    ard_free (sp);
+}
+
+/*
+ * senlib_spectrum_add - Adds samples.
+ */
+int senlib_spectrum_add (struct senlib_spectrum *sp, const int16_t *x, uint32_t n, uint32_t timestamp)
+{
+    uint32_t len = sp->cfg.fft_len;
+    int windows = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (sp->skip)
+        {
+            sp->skip--;
+            continue;
+        }
+        sp->in[sp->fill++] = x[i];
+        if (sp->fill < len)
+            continue;
+
+        spectrum_run (sp, timestamp - (n - 1 - i) * sp->period_us);
+        windows++;
+        if (sp->cfg.hop < len)
+        {
+            memmove (sp->in, sp->in + sp->cfg.hop, (len - sp->cfg.hop) * sizeof (int16_t));
+            sp->fill = len - sp->cfg.hop;
+        }
+        else
+        {
+            sp->fill = 0;
+            sp->skip = sp->cfg.hop - len;
+        }
+    }
+    return windows;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+#ifndef SENSOR_SPECTRUM_H_
+#define SENSOR_SPECTRUM_H_
+
+#include <zephyr/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENLIB_SPECTRUM_MIN_LEN     32
+#define SENLIB_SPECTRUM_MAX_LEN     2048
+#define SENLIB_SPECTRUM_BANDS       8
+
+/*
+ * Callback type, same as SenLib_trigger_fn. Features are passed with
+ * ARDCB_DATAREADY.
+ */
+typedef void (*senlib_spectrum_fn)(uint32_t reason, void *data, int len, uint32_t userdata);
+
+/**
+ * Spectrum analysis setup. Amplitudes are in the units of the samples
+ * passed in, LSB for the accelerometers.
+ */
+struct senlib_spectrum_cfg {
+    uint16_t fft_len;           // Power of two, SENLIB_SPECTRUM_MIN_LEN to _MAX_LEN
+    uint16_t fs_hz;             // Sample rate
+    // Samples from the start of one window to the next. fft_len
+    // gives back to back windows, less overlaps them, more skips
+    // samples between them. 0 is fft_len.
+    uint32_t hop;
+    uint8_t bands;              // Bands to report, up to SENLIB_SPECTRUM_BANDS
+    // Band i is band_edge_hz[i] up to band_edge_hz[i + 1]
+    uint16_t band_edge_hz[SENLIB_SPECTRUM_BANDS + 1];
+    senlib_spectrum_fn fn;
+    uint32_t userdata;
+};
+
+/**
+ * Features of one window, 30 bytes of values for 8 bands.
+ */
+struct senlib_spectrum_features {
+    uint32_t timestamp;         // us since boot of the last sample in the window
+    uint16_t peak_dhz;          // Dominant frequency in 0.1 Hz
+    uint16_t peak_amp;          // Its amplitude
+    uint16_t rms;               // Without the mean (DC)
+    uint16_t peak;              // Largest distance from the mean
+    uint16_t crest;             // peak / rms in hundredths
+    uint8_t bands;
+    uint16_t band_rms[SENLIB_SPECTRUM_BANDS];
+};
+
+struct senlib_spectrum;
+
+/*
+ * Allocates spectrum analysis. Returns 0 if cfg is invalid or on
+ * out of memory.
+ */
+struct senlib_spectrum *senlib_spectrum_alloc (const struct senlib_spectrum_cfg *cfg);
+void senlib_spectrum_free (struct senlib_spectrum *sp);
+
+/*
+ * Adds n samples, timestamp is that of the last. Calls cfg->fn for
+ * each window completed. Returns the number of windows.
+ */
+int senlib_spectrum_add (struct senlib_spectrum *sp, const int16_t *x, uint32_t n, uint32_t timestamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSOR_SPECTRUM_H_ */
@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+/*
+ * Streaming statistics per sensor channel.
+ *
+ * Mean and variance use Welford's update, so no sample needs to be
+ * kept for a tumbling window. Its percentile is estimated with the
+ * P-square algorithm (Jain and Chlamtac), five markers per channel.
+ *
+ * A sliding window keeps its samples in a ring. Welford is run
+ * forward for the sample that comes in and backward for the one
+ * that leaves, and is recomputed from the ring each time it wraps so
+ * rounding doesn't build up. The percentile is selected from a copy
+ * of the ring when it is asked for.
+ *
+ * The math is in float. It runs on the M33 FPU when CONFIG_FPU is
+ * set and in software otherwise.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+#include <math.h>
+
+#include "sensor_stats.h"
+
+struct stats_chan {
+    struct senlib_stats_cfg cfg;
+
+    // Welford
+    uint32_t count;
+    float mean;
+    float m2;
+    int32_t min;
+    int32_t max;
+
+    // P-square markers: heights, positions and desired positions
+    float q[5];
+    int32_t n[5];
+    float np[5];
+
+    // Sliding window
+    int32_t *win;
+    int32_t *scratch;
+    uint16_t head;
+
+    // Last complete tumbling window
+    struct senlib_stats_result last;
+};
+
+struct senlib_stats {
+    uint8_t channels;
+    struct stats_chan chan[];
+};
+
+//----------------------------------------------------
+// chan_reset - Starts a new window.
+//----------------------------------------------------
+static void chan_reset(struct stats_chan *c)
+{
+    c->count = 0;
+    c->mean = 0;
+    c->m2 = 0;
+    c->min = INT32_MAX;
+    c->max = INT32_MIN;
+    c->head = 0;
+}
+
+//----------------------------------------------------
+// psq_add - P-square update of the percentile markers.
+//----------------------------------------------------
+static void psq_add(struct stats_chan *c, float x)
+{
+    float p = c->cfg.quantile / 1000.0f;
+    int i, k;
+
+    // The first five samples are the markers.
+    if (c->count <= 5)
+    {
+        c->q[c->count - 1] = x;
+        if (c->count < 5)
+            return;
+        for (i = 1; i < 5; i++)
+        {
+            float v = c->q[i];
+            for (k = i; (k > 0) && (c->q[k - 1] > v); k--)
+                c->q[k] = c->q[k - 1];
+            c->q[k] = v;
+        }
+        for (i = 0; i < 5; i++)
+            c->n[i] = i;
+        c->np[0] = 0;
+        c->np[1] = 2 * p;
+        c->np[2] = 4 * p;
+        c->np[3] = 2 + 2 * p;
+        c->np[4] = 4;
+        return;
+    }
+
+    // Cell the sample falls in
+    if (x < c->q[0])
+    {
+        c->q[0] = x;
+        k = 0;
+    }
+    else if (x >= c->q[4])
+    {
+        c->q[4] = x;
+        k = 3;
+    }
+    else
+    {
+        for (k = 0; x >= c->q[k + 1]; k++)
+            ;
+    }
+    for (i = k + 1; i < 5; i++)
+        c->n[i]++;
+    c->np[1] += p / 2;
+    c->np[2] += p;
+    c->np[3] += (1 + p) / 2;
+    c->np[4] += 1;
+
+    // Move the middle markers toward their desired positions.
+    for (i = 1; i < 4; i++)
+    {
+        float d = c->np[i] - c->n[i];
+
+        if (((d >= 1) && (c->n[i + 1] - c->n[i] > 1)) ||
+            ((d <= -1) && (c->n[i - 1] - c->n[i] < -1)))
+        {
+            int ds = (d > 0) ? 1 : -1;
+            float qp = c->q[i] + (float)ds / (c->n[i + 1] - c->n[i - 1]) *
+                       ((c->n[i] - c->n[i - 1] + ds) * (c->q[i + 1] - c->q[i]) / (c->n[i + 1] - c->n[i]) +
+                        (c->n[i + 1] - c->n[i] - ds) * (c->q[i] - c->q[i - 1]) / (c->n[i] - c->n[i - 1]));
+
+            if ((c->q[i - 1] < qp) && (qp < c->q[i + 1]))
+                c->q[i] = qp;
+            else
+                c->q[i] += ds * (c->q[i + ds] - c->q[i]) / (c->n[i + ds] - c->n[i]);
+            c->n[i] += ds;
+        }
+    }
+}
+
+//----------------------------------------------------
+// psq_get - Current estimate of the percentile.
+//----------------------------------------------------
+static float psq_get(struct stats_chan *c)
+{
+    float s[5];
+    int i, k, cnt;
+
+    if (c->count >= 5)
+        return c->q[2];
+
+    // Fewer than five samples. Pick from them directly.
+    cnt = c->count;
+    memcpy(s, c->q, cnt * sizeof (float));
+    for (i = 1; i < cnt; i++)
+    {
+        float v = s[i];
+        for (k = i; (k > 0) && (s[k - 1] > v); k--)
+            s[k] = s[k - 1];
+        s[k] = v;
+    }
+    return s[(cnt - 1) * c->cfg.quantile / 1000];
+}
+
+//----------------------------------------------------
+// select_nth - Quickselect. Reorders a.
+//----------------------------------------------------
+static int32_t select_nth(int32_t *a, int n, int k)
+{
+    int lo = 0, hi = n - 1;
+
+    while (lo < hi)
+    {
+        int32_t pivot = a[(lo + hi) / 2];
+        int i = lo, j = hi;
+
+        while (i <= j)
+        {
+            while (a[i] < pivot)
+                i++;
+            while (a[j] > pivot)
+                j--;
+            if (i <= j)
+            {
+                int32_t t = a[i];
+                a[i++] = a[j];
+                a[j--] = t;
+            }
+        }
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            break;
+    }
+    return a[k];
+}
+
+//----------------------------------------------------
+// window_rescan - Recomputes a sliding window from its ring.
+//----------------------------------------------------
+static void window_rescan(struct stats_chan *c)
+{
+    float mean = 0, m2 = 0;
+
+    c->min = INT32_MAX;
+    c->max = INT32_MIN;
+    for (uint32_t i = 0; i < c->count; i++)
+    {
+        int32_t x = c->win[i];
+        float d = x - mean;
+
+        mean += d / (i + 1);
+        m2 += d * (x - mean);
+        c->min = MIN(c->min, x);
+        c->max = MAX(c->max, x);
+    }
+    c->mean = mean;
+    c->m2 = m2;
+}
+
+//----------------------------------------------------
+// fill_result - Result of the samples in c.
+//----------------------------------------------------
+static void fill_result(struct stats_chan *c, struct senlib_stats_result *res)
+{
+    res->count = c->count;
+    res->min = c->min;
+    res->max = c->max;
+    res->mean = (int32_t)lroundf(c->mean);
+    res->stddev = (c->count > 1) ? (int32_t)lroundf(sqrtf(c->m2 / (c->count - 1))) : 0;
+    res->quantile = 0;
+    if (c->cfg.quantile && c->count)
+    {
+        if (c->cfg.type == SENLIB_STATS_TUMBLING)
+        {
+            res->quantile = (int32_t)lroundf(psq_get(c));
+        }
+        else
+        {
+            memcpy(c->scratch, c->win, c->count * sizeof (int32_t));
+            res->quantile = select_nth(c->scratch, c->count,
+                                       (c->count - 1) * c->cfg.quantile / 1000);
+        }
+    }
+}
+
+/*
+ * senlib_stats_alloc - Allocates statistics, all channels off.
+ */
+struct senlib_stats *senlib_stats_alloc (uint8_t channels)
+{
+    size_t size = sizeof (struct senlib_stats) + channels * sizeof (struct stats_chan);
+    struct senlib_stats *st = ard_malloc (size);
+
+    if (st)
+    {
+        memset (st, 0, size);
+        st->channels = channels;
+    }
+    return st;
+}
+
+/*
+ * senlib_stats_free - Frees statistics.
+ */
+void senlib_stats_free (struct senlib_stats *st)
+{
+    for (int i = 0; i < st->channels; i++)
+    {
+        if (st->chan[i].win)
+            ard_free (st->chan[i].win);
+    }
+    ard_free (st);
+}
+
+/*
+ * senlib_stats_setup - Sets up one channel.
+ */
+int senlib_stats_setup (struct senlib_stats *st, const struct senlib_stats_cfg *cfg)
+{
+    struct stats_chan *c;
+
+    if ((cfg->channel >= st->channels) || (cfg->type > SENLIB_STATS_SLIDING) ||
+        (cfg->quantile > 1000) || ((cfg->type != SENLIB_STATS_OFF) && (cfg->samples == 0)))
+        return -EINVAL;
+
+    c = &st->chan[cfg->channel];
+    if (c->win)
+    {
+        ard_free (c->win);
+        c->win = 0;
+    }
+    memset (c, 0, sizeof (struct stats_chan));
+
+    if (cfg->type == SENLIB_STATS_SLIDING)
+    {
+        // Ring and quickselect scratch in one block
+        c->win = ard_malloc (2 * cfg->samples * sizeof (int32_t));
+        if (c->win == 0)
+            return -ENOMEM;
+        c->scratch = c->win + cfg->samples;
+    }
+    c->cfg = *cfg;
+    chan_reset (c);
+    return 0;
+}
+
+/*
+ * senlib_stats_add - Adds one sample of every channel.
+ */
+void senlib_stats_add (struct senlib_stats *st, const int32_t *val)
+{
+    for (int i = 0; i < st->channels; i++)
+    {
+        struct stats_chan *c = &st->chan[i];
+        int32_t x = val[i];
+        float d;
+
+        switch (c->cfg.type)
+        {
+        case SENLIB_STATS_TUMBLING:
+            c->count++;
+            d = x - c->mean;
+            c->mean += d / c->count;
+            c->m2 += d * (x - c->mean);
+            c->min = MIN(c->min, x);
+            c->max = MAX(c->max, x);
+            if (c->cfg.quantile)
+                psq_add (c, x);
+
+            if (c->count == c->cfg.samples)
+            {
+                uint32_t windows = c->last.windows;
+
+                fill_result (c, &c->last);
+                c->last.windows = windows + 1;
+                chan_reset (c);
+            }
+            break;
+
+        case SENLIB_STATS_SLIDING:
+            if (c->count < c->cfg.samples)
+            {
+                c->win[c->count++] = x;
+                d = x - c->mean;
+                c->mean += d / c->count;
+                c->m2 += d * (x - c->mean);
+                c->min = MIN(c->min, x);
+                c->max = MAX(c->max, x);
+                break;
+            }
+
+            {
+                int32_t old = c->win[c->head];
+                float n = c->count;
+                float mean;
+
+                c->win[c->head] = x;
+                if (++c->head == c->cfg.samples)
+                {
+                    // Wrapped. Start from exact values again.
+                    c->head = 0;
+                    window_rescan (c);
+                    break;
+                }
+
+                // Take the old sample out and the new one in.
+                d = (float)x - (float)old;
+                mean = c->mean + d / n;
+                c->m2 += d * (x - mean + old - c->mean);
+                c->mean = mean;
+                if (c->m2 < 0)
+                    c->m2 = 0;
+
+                if ((old == c->min) || (old == c->max))
+                    window_rescan (c);
+                else
+                {
+                    c->min = MIN(c->min, x);
+                    c->max = MAX(c->max, x);
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+/*
+ * senlib_stats_result - Reports one channel.
+ */
+int senlib_stats_result (struct senlib_stats *st, struct senlib_stats_result *res)
+{
+    struct stats_chan *c;
+    uint8_t channel = res->channel;
+    bool partial = res->partial;
+
+    if (channel >= st->channels)
+        return -EINVAL;
+    c = &st->chan[channel];
+
+    switch (c->cfg.type)
+    {
+    case SENLIB_STATS_TUMBLING:
+        if (partial)
+        {
+            if (c->count == 0)
+                return -EAGAIN;
+            fill_result (c, res);
+            res->windows = c->last.windows;
+        }
+        else
+        {
+            if (c->last.windows == 0)
+                return -EAGAIN;
+            *res = c->last;
+        }
+        break;
+
+    case SENLIB_STATS_SLIDING:
+        if (c->count == 0)
+            return -EAGAIN;
+        fill_result (c, res);
+        res->windows = 0;
+        break;
+
+    default:
+        return -EINVAL;
+    }
+    res->channel = channel;
+    res->partial = partial;
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Ericsson AB 2020, all rights reserved
+ */
+#ifndef SENSOR_STATS_H_
+#define SENSOR_STATS_H_
+
+#include <zephyr/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Window types */
+#define SENLIB_STATS_OFF         0
+/* Consecutive windows of a fixed number of samples */
+#define SENLIB_STATS_TUMBLING    1
+/* The last samples, updated with every sample */
+#define SENLIB_STATS_SLIDING     2
+
+/**
+ * Statistics set up for one channel.
+ */
+struct senlib_stats_cfg {
+    uint8_t channel;            // Index in the sensor's channels
+    uint8_t type;               // SENLIB_STATS_xxx
+    uint16_t samples;           // Window length. At a 1 s period, 600 is 10 minutes.
+    uint16_t quantile;          // Percentile reported in per mille, e.g. 950 for P95. 0 for none.
+};
+
+/**
+ * Statistics of one window. Values are in the channel's milli-units.
+ */
+struct senlib_stats_result {
+    uint8_t channel;            // Set by the caller
+    bool partial;               // Set by the caller to get the window still filling
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    int32_t mean;
+    int32_t stddev;
+    int32_t quantile;
+    uint32_t windows;           // Tumbling windows completed
+};
+
+struct senlib_stats;
+
+/*
+ * Allocates statistics for a sensor with channels channels, all off.
+ */
+struct senlib_stats *senlib_stats_alloc (uint8_t channels);
+
+/*
+ * Frees statistics from senlib_stats_alloc.
+ */
+void senlib_stats_free (struct senlib_stats *st);
+
+/*
+ * Sets up or turns off the statistics of one channel. Clears it.
+ */
+int senlib_stats_setup (struct senlib_stats *st, const struct senlib_stats_cfg *cfg);
+
+/*
+ * Adds one sample of all channels, in milli-units.
+ */
+void senlib_stats_add (struct senlib_stats *st, const int32_t *val);
+
+/*
+ * Fills res for res->channel. Tumbling windows report the last
+ * complete window unless res->partial is set. Returns -EAGAIN if
+ * there is nothing to report yet.
+ */
+int senlib_stats_result (struct senlib_stats *st, struct senlib_stats_result *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSOR_STATS_H_ */
@@ -8,10 +8,10 @@
 
 #include <ardesco.h>
 
+#include <soc.h>
 #include <device.h>
 #include <drivers/uart.h>
 #include <hal/nrf_power.h>
-#include <power/reboot.h>
 #include <usb/usb_device.h>
 
 #include <serial_52lib.h>
@@ -19,9 +19,6 @@
 // Indicates USB is connected.
 uint8_t USB_active = 1;
 
-#define POWER_THREAD_STACKSIZE		CONFIG_IDLE_STACK_SIZE
-#define POWER_THREAD_PRIORITY		K_LOWEST_APPLICATION_THREAD_PRIO
-
 /*
  * uart_interrupt_handler - All UARTs on the 52840
  * must share one ISR. This code receives all isr 
@@ -37,35 +34,70 @@ static void uart_interrupt_handler(const struct device *dev, void *user_data)
 #endif
 {
 	struct serial_isr_info *isr_info = user_data;
+#ifdef CONFIG_SERIAL_52LIB_ISR_STATS
+	uint32_t start = DWT->CYCCNT;
+	uint32_t cycles;
+#endif
 
 	isr_info->irq_fn (isr_info->user_data);
+
+#ifdef CONFIG_SERIAL_52LIB_ISR_STATS
+	// Track the worst case execution time of the ISR.
+	cycles = DWT->CYCCNT - start;
+	isr_info->isr_cnt++;
+	if (cycles > isr_info->isr_max_cycles)
+		isr_info->isr_max_cycles = cycles;
+#endif
 	return;
 }
 
 
-static K_THREAD_STACK_DEFINE(power_thread_stack, POWER_THREAD_STACKSIZE);
-static struct k_thread power_thread_data;
-
 struct k_sem power_event_sem;
 
+// Application callback for USB status changes.
+static usb_dc_status_callback app_status_cb;
+
 /*
- * power_thread - This code clears the USB_active flag when a
- * usb connection is no longer detected
+ * usb_status_cb - Called by the USB stack. VBUS detect and 
+ * removal come from the POWER peripheral USBDETECTED and 
+ * USBREMOVED events, so nothing has to poll for them. Each 
+ * change updates USB_active and is signalled on power_event_sem.
  */
-static void power_thread(void *p1, void *p2, void *p3)
+static void usb_status_cb(enum usb_dc_status_code status, const uint8_t *param)
 {
-	while (USB_active) 
+	switch (status)
 	{
-		if (!nrf_power_usbregstatus_vbusdet_get(NRF_POWER)) 
+	case USB_DC_CONNECTED:
+		if (!USB_active)
+		{
+			USB_active = 1;
+			k_sem_give(&power_event_sem);
+		}
+		break;
+	case USB_DC_DISCONNECTED:
+		if (USB_active)
 		{
 			USB_active = 0;
-			// This allows signalling of the disconnect event.
 			k_sem_give(&power_event_sem);
-			return;
 		}
-		k_sleep(K_MSEC(100));
+		break;
+	default:
+		break;
 	}
+
+	if (app_status_cb)
+		app_status_cb(status, param);
 }
+
+/*
+ * serial_lib_set_usb_status_cb - Lets the application see USB
+ * status changes as well. Set before the USB is enabled.
+ */
+void serial_lib_set_usb_status_cb(usb_dc_status_callback cb)
+{
+	app_status_cb = cb;
+}
+
 static int usb_enabled = 0;
 /*
  * common_init_usb - coordinates multiple libraries that may
@@ -77,7 +109,7 @@ int common_init_usb ()
 	int rc;
 	if (usb_enabled > 0)
 		return 0;
-	rc = usb_enable(NULL);
+	rc = usb_enable(usb_status_cb);
 	if (rc == 0)
 		usb_enabled++;
 	return rc;
@@ -95,12 +127,16 @@ void serial_lib_init(void)
 
 	k_sem_init(&power_event_sem, 0, 1);
 
-	USB_active = 1;
+	// Later changes are reported by usb_status_cb.
+	USB_active = nrf_power_usbregstatus_vbusdet_get(NRF_POWER) ? 1 : 0;
 
-	// Start power thread to monitor USB.
-	k_thread_create(&power_thread_data, power_thread_stack,
-			K_THREAD_STACK_SIZEOF(power_thread_stack), power_thread, NULL,
-			NULL, NULL, POWER_THREAD_PRIORITY, 0, K_NO_WAIT);
+#if defined(CONFIG_SERIAL_52LIB_ISR_STATS) || defined(CONFIG_SERIAL_52LIB_TAP)
+	// Start the cycle counter used to time the ISRs and
+	// timestamp the tap.
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
 	return;
 }
 
@@ -117,3 +153,15 @@ void serial_lib_register_isr (const struct device *dev, struct serial_isr_info *
 	uart_irq_callback_user_data_set(dev, uart_interrupt_handler, isr_info);
 }
 
+/*
+ * serial_lib_clear_isr_stats - reset the ISR timing of an isr
+ *
+ */ 
+void serial_lib_clear_isr_stats (struct serial_isr_info *isr_info)
+{
+	unsigned int key = irq_lock();
+
+	isr_info->isr_cnt = 0;
+	isr_info->isr_max_cycles = 0;
+	irq_unlock(key);
+}
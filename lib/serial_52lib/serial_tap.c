@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2020 Ericsson AB
+ *
+ */
+/*
+ * Capture of the traffic crossing the 9160 <--> 52840 UARTs.
+ *
+ * Chunks are recorded into a fixed array of slots. A producer
+ * reserves a slot by advancing the head with a compare and swap,
+ * fills it, then commits it by writing the slot's sequence number.
+ * No locks are taken so the tap can be called from any ISR or
+ * thread. The stream thread consumes committed slots in order and
+ * writes them out a CDC ACM device as a pcap stream.
+ */
+
+#include <ardesco.h>
+#include <string.h>
+
+#include <soc.h>
+#include <device.h>
+#include <drivers/uart.h>
+#include <sys/atomic.h>
+
+#include <serial_tap.h>
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SERIAL_52LIB_TAP_SLOTS
+#define CONFIG_SERIAL_52LIB_TAP_SLOTS 128
+#endif //CONFIG_SERIAL_52LIB_TAP_SLOTS
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_SERIAL_52LIB_TAP_SLOT_DATA
+#define CONFIG_SERIAL_52LIB_TAP_SLOT_DATA 48
+#endif //CONFIG_SERIAL_52LIB_TAP_SLOT_DATA
+
+BUILD_ASSERT((CONFIG_SERIAL_52LIB_TAP_SLOTS & (CONFIG_SERIAL_52LIB_TAP_SLOTS - 1)) == 0,
+	     "CONFIG_SERIAL_52LIB_TAP_SLOTS must be a power of two");
+
+#define TAP_STREAM_STACKSIZE	1024
+#define TAP_STREAM_PRIORITY	K_LOWEST_APPLICATION_THREAD_PRIO
+
+// pcap framing
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_LINKTYPE_USER0 147
+
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} __packed;
+
+struct pcap_rec_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+} __packed;
+
+struct tap_slot {
+	// Index + 1 of the record once it is complete.
+	atomic_t seq;
+	uint32_t cycles;
+	// Kernel cycle count, for the pcap time of day.
+	uint32_t time;
+	uint8_t port;
+	uint8_t dir;
+	uint16_t len;
+	uint8_t data[CONFIG_SERIAL_52LIB_TAP_SLOT_DATA];
+};
+
+static struct tap_slot tap_slots[CONFIG_SERIAL_52LIB_TAP_SLOTS];
+
+// Next slot to reserve and next slot to stream. Both only grow.
+static atomic_t tap_head;
+static atomic_t tap_tail;
+
+static atomic_t tap_records;
+static atomic_t tap_dropped;
+static atomic_t tap_truncated;
+
+static bool tap_enabled = true;
+
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
+static struct device *tap_stream_dev;
+#else
+static const struct device *tap_stream_dev;
+#endif
+static K_SEM_DEFINE(tap_stream_sem, 0, 1);
+
+/*
+ * serial_tap_record - Copies a chunk into the next free slot.
+ * If the stream hasn't kept up, the chunk is counted as dropped
+ * rather than overwriting a record that hasn't been sent.
+ */
+void serial_tap_record(uint8_t port, uint8_t dir, const uint8_t *data, uint32_t len)
+{
+	struct tap_slot *slot;
+	atomic_val_t idx;
+	uint32_t cp;
+
+	if (!tap_enabled || (len == 0))
+		return;
+
+	// Reserve a slot.
+	do
+	{
+		idx = atomic_get(&tap_head);
+		if ((uint32_t)(idx - atomic_get(&tap_tail)) >= CONFIG_SERIAL_52LIB_TAP_SLOTS)
+		{
+			atomic_inc(&tap_dropped);
+			return;
+		}
+	} while (!atomic_cas(&tap_head, idx, idx + 1));
+
+	slot = &tap_slots[idx & (CONFIG_SERIAL_52LIB_TAP_SLOTS - 1)];
+	slot->cycles = DWT->CYCCNT;
+	slot->time = k_cycle_get_32();
+	slot->port = port;
+	slot->dir = dir;
+	slot->len = len;
+
+	cp = len;
+	if (cp > CONFIG_SERIAL_52LIB_TAP_SLOT_DATA)
+	{
+		cp = CONFIG_SERIAL_52LIB_TAP_SLOT_DATA;
+		atomic_inc(&tap_truncated);
+	}
+	memcpy(slot->data, data, cp);
+
+	// Commit. The stream thread won't look at the slot before this.
+	atomic_set(&slot->seq, idx + 1);
+	atomic_inc(&tap_records);
+}
+
+/*
+ * serial_tap_enable - Turns recording on or off.
+ */
+void serial_tap_enable(bool enable)
+{
+	tap_enabled = enable;
+}
+
+/*
+ * serial_tap_get_stats - Reads the capture counters.
+ */
+void serial_tap_get_stats(struct serial_tap_stats *stats)
+{
+	stats->records = atomic_get(&tap_records);
+	stats->dropped = atomic_get(&tap_dropped);
+	stats->truncated = atomic_get(&tap_truncated);
+}
+
+/*
+ * tap_write - Writes a block out the stream device, waiting for
+ * room in the CDC ACM buffer. Returns -1 if the stream was stopped.
+ */
+static int tap_write(const void *data, int len)
+{
+	const uint8_t *p = data;
+	int n;
+
+	while (len > 0)
+	{
+		if (!tap_stream_dev)
+			return -1;
+
+		n = uart_fifo_fill(tap_stream_dev, p, len);
+		if (n <= 0)
+		{
+			k_sleep(K_MSEC(1));
+			continue;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * tap_stream_thread - Waits for a stream to be started, then
+ * sends the pcap file header followed by every committed record.
+ */
+static void tap_stream_thread(void *p1, void *p2, void *p3)
+{
+	struct pcap_file_hdr fhdr = {
+		.magic = PCAP_MAGIC,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = sizeof(struct serial_tap_pcap_hdr) +
+		           CONFIG_SERIAL_52LIB_TAP_SLOT_DATA,
+		.linktype = PCAP_LINKTYPE_USER0,
+	};
+	struct {
+		struct pcap_rec_hdr rec;
+		struct serial_tap_pcap_hdr tap;
+		uint8_t data[CONFIG_SERIAL_52LIB_TAP_SLOT_DATA];
+	} __packed out;
+
+	while (1)
+	{
+		k_sem_take(&tap_stream_sem, K_FOREVER);
+
+		if (tap_write(&fhdr, sizeof(fhdr)))
+			continue;
+
+		while (tap_stream_dev)
+		{
+			atomic_val_t idx = atomic_get(&tap_tail);
+			struct tap_slot *slot = &tap_slots[idx & (CONFIG_SERIAL_52LIB_TAP_SLOTS - 1)];
+			uint32_t cp;
+			uint64_t us;
+
+			// Nothing committed yet.
+			if (atomic_get(&slot->seq) != idx + 1)
+			{
+				k_sleep(K_MSEC(10));
+				continue;
+			}
+
+			cp = MIN(slot->len, CONFIG_SERIAL_52LIB_TAP_SLOT_DATA);
+			us = k_cyc_to_us_floor64(slot->time);
+			out.rec.ts_sec = (uint32_t)(us / USEC_PER_SEC);
+			out.rec.ts_usec = (uint32_t)(us % USEC_PER_SEC);
+			out.rec.incl_len = sizeof(out.tap) + cp;
+			out.rec.orig_len = sizeof(out.tap) + slot->len;
+			out.tap.cycles = slot->cycles;
+			out.tap.port = slot->port;
+			out.tap.dir = slot->dir;
+			out.tap.len = slot->len;
+			memcpy(out.data, slot->data, cp);
+
+			// Hand the slot back before the slow part.
+			atomic_set(&tap_tail, idx + 1);
+
+			tap_write(&out, sizeof(out.rec) + out.rec.incl_len);
+		}
+	}
+}
+
+K_THREAD_DEFINE(tap_stream_id, TAP_STREAM_STACKSIZE, tap_stream_thread,
+		NULL, NULL, NULL, TAP_STREAM_PRIORITY, 0, 0);
+
+/*
+ * serial_tap_stream_start - Starts streaming out a CDC ACM device.
+ */
+int serial_tap_stream_start(const char *dev_name)
+{
+	if (tap_stream_dev)
+		return -EBUSY;
+
+	tap_stream_dev = device_get_binding(dev_name);
+	if (!tap_stream_dev)
+		return -ENODEV;
+
+	k_sem_give(&tap_stream_sem);
+	return 0;
+}
+
+/*
+ * serial_tap_stream_stop - Stops streaming.
+ */
+void serial_tap_stream_stop(void)
+{
+	tap_stream_dev = NULL;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2020 Ericsson AB
+ *
+ */
+/*
+ * Modem trace relay. The 9160 BSD library sends modem trace out
+ * its UARTE1 at 1 Mbaud. Here the 52840 UART on the other end is
+ * run with the async (DMA) API into a ring buffer that is drained
+ * to a dedicated CDC ACM device. The UART gets a new DMA buffer
+ * from the driver's buffer request so reception never stops
+ * between buffers.
+ */
+
+#include <ardesco.h>
+
+#include <device.h>
+#include <drivers/uart.h>
+#include <sys/ring_buffer.h>
+
+#include <serial_52lib.h>
+#include <usb_uart.h>
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_TRACE_UART_DEV_NAME
+#define CONFIG_USB_UART_TRACE_UART_DEV_NAME "UART_1"
+#endif //CONFIG_USB_UART_TRACE_UART_DEV_NAME
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_TRACE_USB_DEV_NAME
+#define CONFIG_USB_UART_TRACE_USB_DEV_NAME "CDC_ACM_1"
+#endif //CONFIG_USB_UART_TRACE_USB_DEV_NAME
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_TRACE_RING_SIZE
+#define CONFIG_USB_UART_TRACE_RING_SIZE 8192
+#endif //CONFIG_USB_UART_TRACE_RING_SIZE
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_TRACE_DMA_BUF_SIZE
+#define CONFIG_USB_UART_TRACE_DMA_BUF_SIZE 256
+#endif //CONFIG_USB_UART_TRACE_DMA_BUF_SIZE
+
+// Inactivity (ms) after which a partly filled DMA buffer is passed on.
+#define TRACE_RX_TIMEOUT	1
+
+RING_BUF_DECLARE(usb_uart_trace_ring, CONFIG_USB_UART_TRACE_RING_SIZE);
+static struct k_spinlock trace_lock;
+
+// Two DMA buffers. One is filling while the other is queued.
+static uint8_t trace_dma_buf[2][CONFIG_USB_UART_TRACE_DMA_BUF_SIZE];
+static uint8_t trace_dma_next;
+
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
+static struct device *trace_uart_dev;
+static struct device *trace_usb_dev;
+#else
+static const struct device *trace_uart_dev;
+static const struct device *trace_usb_dev;
+#endif
+
+static struct serial_isr_info trace_isr_info;
+static struct usb_uart_trace_stats trace_stats;
+
+/*
+ * trace_rx_start - Starts DMA reception into the first buffer.
+ */
+static int trace_rx_start(void)
+{
+	trace_dma_next = 1;
+	return uart_rx_enable(trace_uart_dev, trace_dma_buf[0],
+	                      sizeof(trace_dma_buf[0]), TRACE_RX_TIMEOUT);
+}
+
+/*
+ * trace_uart_cb - Async UART events. Runs in the UARTE ISR.
+ */
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
+static void trace_uart_cb(struct uart_event *evt, void *user_data)
+#else
+static void trace_uart_cb(const struct device *dev, struct uart_event *evt,
+                          void *user_data)
+#endif
+{
+	k_spinlock_key_t key;
+	uint32_t put, used;
+
+	switch (evt->type)
+	{
+	case UART_RX_RDY:
+		key = k_spin_lock(&trace_lock);
+		put = ring_buf_put(&usb_uart_trace_ring,
+		                   evt->data.rx.buf + evt->data.rx.offset,
+		                   evt->data.rx.len);
+		used = ring_buf_capacity_get(&usb_uart_trace_ring) -
+		       ring_buf_space_get(&usb_uart_trace_ring);
+		k_spin_unlock(&trace_lock, key);
+
+		trace_stats.bytes += put;
+		// The 9160 has no flow control on the trace, so all we
+		// can do when the USB doesn't keep up is count.
+		trace_stats.dropped += evt->data.rx.len - put;
+		if (used > trace_stats.max_fill)
+			trace_stats.max_fill = used;
+
+		uart_irq_tx_enable(trace_usb_dev);
+		break;
+
+	case UART_RX_BUF_REQUEST:
+		uart_rx_buf_rsp(trace_uart_dev, trace_dma_buf[trace_dma_next],
+		                sizeof(trace_dma_buf[0]));
+		trace_dma_next ^= 1;
+		break;
+
+	case UART_RX_STOPPED:
+		if (evt->data.rx_stop.reason & UART_ERROR_OVERRUN)
+			trace_stats.overruns++;
+		else
+			trace_stats.errors++;
+		break;
+
+	case UART_RX_DISABLED:
+		// Stopped on an error. Start again.
+		trace_rx_start();
+		break;
+
+	default:
+		break;
+	}
+}
+
+/*
+ * trace_usb_isr - CDC ACM side. Sends the ring out the USB and
+ * throws away anything the host writes.
+ */
+static void trace_usb_isr(void *user_data)
+{
+	k_spinlock_key_t key;
+	uint8_t *data;
+	uint8_t discard[16];
+	int len;
+
+	uart_irq_update(trace_usb_dev);
+
+	while (uart_irq_rx_ready(trace_usb_dev))
+	{
+		if (uart_fifo_read(trace_usb_dev, discard, sizeof(discard)) <= 0)
+			break;
+	}
+
+	if (uart_irq_tx_ready(trace_usb_dev))
+	{
+		key = k_spin_lock(&trace_lock);
+		len = ring_buf_get_claim(&usb_uart_trace_ring, &data,
+		                         CONFIG_USB_UART_TRACE_RING_SIZE);
+		k_spin_unlock(&trace_lock, key);
+
+		/* Nothing in the ring, nothing to send */
+		if (len == 0)
+		{
+			uart_irq_tx_disable(trace_usb_dev);
+			return;
+		}
+
+		len = uart_fifo_fill(trace_usb_dev, data, len);
+
+		key = k_spin_lock(&trace_lock);
+		ring_buf_get_finish(&usb_uart_trace_ring, (len > 0) ? len : 0);
+		k_spin_unlock(&trace_lock, key);
+	}
+}
+
+/*
+ * usb_uart_trace_init - Starts relaying modem trace. The USB
+ * must already be enabled.
+ */
+int usb_uart_trace_init(void)
+{
+	int ret;
+
+	trace_uart_dev = device_get_binding(CONFIG_USB_UART_TRACE_UART_DEV_NAME);
+	trace_usb_dev = device_get_binding(CONFIG_USB_UART_TRACE_USB_DEV_NAME);
+	if (!trace_uart_dev || !trace_usb_dev)
+	{
+		printk("Modem trace relay init failed\n");
+		return -ENODEV;
+	}
+
+	trace_isr_info.irq_fn = trace_usb_isr;
+	trace_isr_info.user_data = NULL;
+	serial_lib_register_isr(trace_usb_dev, &trace_isr_info);
+	uart_irq_rx_enable(trace_usb_dev);
+
+	ret = uart_callback_set(trace_uart_dev, trace_uart_cb, NULL);
+	if (ret == 0)
+		ret = trace_rx_start();
+	if (ret)
+	{
+		printk("%s: async rx failed (%d)\n", CONFIG_USB_UART_TRACE_UART_DEV_NAME, ret);
+		return ret;
+	}
+	printk("Modem trace relay %s --> %s\n", CONFIG_USB_UART_TRACE_UART_DEV_NAME,
+	       CONFIG_USB_UART_TRACE_USB_DEV_NAME);
+	return 0;
+}
+
+/*
+ * usb_uart_trace_get_stats - Reads the trace relay counters.
+ */
+void usb_uart_trace_get_stats(struct usb_uart_trace_stats *stats)
+{
+	unsigned int key = irq_lock();
+
+	*stats = trace_stats;
+	irq_unlock(key);
+}
@@ -6,19 +6,34 @@
  */
 /*
  * Derived from usb_uart_bridge.c
- */ 
+ */
 
 #include <ardesco.h>
+#include <string.h>
 
 #include <device.h>
+#if (NRF_VERSION_MAJOR > 1) || (NRF_VERSION_MINOR >= 3)
+#include <devicetree.h>
+#endif
 #include <drivers/uart.h>
 #include <hal/nrf_power.h>
-#include <power/reboot.h>
 #include <usb/usb_device.h>
+#include <sys/ring_buffer.h>
+#ifdef CONFIG_CDC_ACM_DTE_RATE_CALLBACK_SUPPORT
+#include <usb/class/usb_cdc.h>
+#endif
 
 #include <serial_52lib.h>
+#include <serial_tap.h>
 #include <usb_uart.h>
 
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 3)
+// NCS 1.2 timeouts are in ms and BUILD_ASSERT takes no message.
+#define K_USEC(us)  (((us) + 999) / 1000)
+#undef BUILD_ASSERT
+#define BUILD_ASSERT BUILD_ASSERT_MSG
+#endif
+
 // fallback define for non-kconfig builds.
 #ifndef CONFIG_PASSTHROUGH_UART_DEV_NAME
 #define CONFIG_PASSTHROUGH_UART_DEV_NAME "UART_0"
@@ -29,167 +44,526 @@
 #define CONFIG_PASSTHROUGH_USB_DEV_NAME "CDC_ACM_0"
 #endif //CONFIG_PASSTHROUGH_USB_DEV_NAME
 
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_USB_TO_UART_RING_SIZE
+#define CONFIG_USB_UART_USB_TO_UART_RING_SIZE 1024
+#endif //CONFIG_USB_UART_USB_TO_UART_RING_SIZE
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_UART_TO_USB_RING_SIZE
+#define CONFIG_USB_UART_UART_TO_USB_RING_SIZE 2048
+#endif //CONFIG_USB_UART_UART_TO_USB_RING_SIZE
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_FLUSH_THRESHOLD
+#define CONFIG_USB_UART_FLUSH_THRESHOLD 1
+#endif //CONFIG_USB_UART_FLUSH_THRESHOLD
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_FLOW_HIGH_WATERMARK
+#define CONFIG_USB_UART_FLOW_HIGH_WATERMARK 768
+#endif //CONFIG_USB_UART_FLOW_HIGH_WATERMARK
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_FLOW_LOW_WATERMARK
+#define CONFIG_USB_UART_FLOW_LOW_WATERMARK 256
+#endif //CONFIG_USB_UART_FLOW_LOW_WATERMARK
+
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_IDLE_TIMEOUT_US
+#define CONFIG_USB_UART_IDLE_TIMEOUT_US 1000
+#endif //CONFIG_USB_UART_IDLE_TIMEOUT_US
+
+#ifdef CONFIG_UART_LINE_CTRL
+// fallback define for non-kconfig builds.
+#ifndef CONFIG_USB_UART_LINE_POLL_MS
+#define CONFIG_USB_UART_LINE_POLL_MS 100
+#endif //CONFIG_USB_UART_LINE_POLL_MS
+#endif //CONFIG_UART_LINE_CTRL
 
 // Indicates USB is connected.
 extern uint8_t USB_active;
 extern struct k_sem power_event_sem;
 
-static struct serial_dev {
+/*
+ * Static settings of one USB <--> UART pair.
+ */
+struct usb_uart_pair_cfg {
+	const char *usb_name;
+	const char *uart_name;
+	// Data waiting to go out the USB and out the UART.
+	struct ring_buf *usb_tx_ring;
+	struct ring_buf *uart_tx_ring;
+	uint32_t flow_high;
+	uint32_t flow_low;
+	uint32_t idle_timeout_us;
+};
+
+/*
+ * Pairs are declared in devicetree with nodes compatible with
+ * "ardesco,usb-uart-bridge". Without any, a single pair is
+ * made from the CONFIG_PASSTHROUGH_* settings. NCS 1.2 has no
+ * devicetree instance macros, so there the nodes are checked
+ * against the binding but the CONFIG_PASSTHROUGH_* pair is used.
+ */
+#define DT_DRV_COMPAT ardesco_usb_uart_bridge
+
+#if !defined(DT_HAS_COMPAT_STATUS_OKAY)
+#define USB_UART_DT_PAIRS 0
+#elif DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+#define USB_UART_DT_PAIRS 1
+#else
+#define USB_UART_DT_PAIRS 0
+#endif
+
+#if USB_UART_DT_PAIRS
+
+#define USB_UART_RING_TO_USB(inst) \
+	DT_INST_PROP_OR(inst, uart_to_usb_ring_size, CONFIG_USB_UART_UART_TO_USB_RING_SIZE)
+#define USB_UART_RING_TO_UART(inst) \
+	DT_INST_PROP_OR(inst, usb_to_uart_ring_size, CONFIG_USB_UART_USB_TO_UART_RING_SIZE)
+#define USB_UART_FLOW_HIGH(inst) \
+	DT_INST_PROP_OR(inst, flow_high_watermark, CONFIG_USB_UART_FLOW_HIGH_WATERMARK)
+#define USB_UART_FLOW_LOW(inst) \
+	DT_INST_PROP_OR(inst, flow_low_watermark, CONFIG_USB_UART_FLOW_LOW_WATERMARK)
+
+#define USB_UART_PAIR_RINGS(inst)						\
+	RING_BUF_DECLARE(usb_uart_usb_tx_ring_##inst, USB_UART_RING_TO_USB(inst));	\
+	RING_BUF_DECLARE(usb_uart_uart_tx_ring_##inst, USB_UART_RING_TO_UART(inst));	\
+	BUILD_ASSERT((USB_UART_FLOW_HIGH(inst) < USB_UART_RING_TO_USB(inst)) &&	\
+		     (USB_UART_FLOW_HIGH(inst) < USB_UART_RING_TO_UART(inst)),	\
+		     "usb-uart-bridge flow-high-watermark must be below the ring sizes"); \
+	BUILD_ASSERT(USB_UART_FLOW_LOW(inst) < USB_UART_FLOW_HIGH(inst),	\
+		     "usb-uart-bridge flow-low-watermark must be below the high watermark");
+
+#define USB_UART_PAIR_CFG(inst)							\
+	{									\
+		.usb_name = DT_INST_PROP(inst, usb_label),			\
+		.uart_name = DT_LABEL(DT_INST_PHANDLE(inst, uart)),		\
+		.usb_tx_ring = &usb_uart_usb_tx_ring_##inst,			\
+		.uart_tx_ring = &usb_uart_uart_tx_ring_##inst,			\
+		.flow_high = USB_UART_FLOW_HIGH(inst),				\
+		.flow_low = USB_UART_FLOW_LOW(inst),				\
+		.idle_timeout_us = DT_INST_PROP_OR(inst, idle_timeout_us,	\
+					CONFIG_USB_UART_IDLE_TIMEOUT_US),	\
+	},
+
+DT_INST_FOREACH_STATUS_OKAY(USB_UART_PAIR_RINGS)
+
+static const struct usb_uart_pair_cfg pair_cfg[] = {
+	DT_INST_FOREACH_STATUS_OKAY(USB_UART_PAIR_CFG)
+};
+
+#else
+
+BUILD_ASSERT((CONFIG_USB_UART_FLOW_HIGH_WATERMARK < CONFIG_USB_UART_USB_TO_UART_RING_SIZE) &&
+	     (CONFIG_USB_UART_FLOW_HIGH_WATERMARK < CONFIG_USB_UART_UART_TO_USB_RING_SIZE),
+	     "Flow control high watermark must be below the ring sizes");
+BUILD_ASSERT(CONFIG_USB_UART_FLOW_LOW_WATERMARK < CONFIG_USB_UART_FLOW_HIGH_WATERMARK,
+	     "Flow control low watermark must be below the high watermark");
+
+RING_BUF_DECLARE(usb_uart_usb_tx_ring_0, CONFIG_USB_UART_UART_TO_USB_RING_SIZE);
+RING_BUF_DECLARE(usb_uart_uart_tx_ring_0, CONFIG_USB_UART_USB_TO_UART_RING_SIZE);
+
+static const struct usb_uart_pair_cfg pair_cfg[] = {
+	{
+		.usb_name = CONFIG_PASSTHROUGH_USB_DEV_NAME,
+		.uart_name = CONFIG_PASSTHROUGH_UART_DEV_NAME,
+		.usb_tx_ring = &usb_uart_usb_tx_ring_0,
+		.uart_tx_ring = &usb_uart_uart_tx_ring_0,
+		.flow_high = CONFIG_USB_UART_FLOW_HIGH_WATERMARK,
+		.flow_low = CONFIG_USB_UART_FLOW_LOW_WATERMARK,
+		.idle_timeout_us = CONFIG_USB_UART_IDLE_TIMEOUT_US,
+	},
+};
+
+#endif //USB_UART_DT_PAIRS
+
+#define USB_UART_PAIRS ARRAY_SIZE(pair_cfg)
+
+/*
+ * One side of a pair. Data received on a device is put
+ * directly in the tx ring of its peer.
+ */
+struct serial_dev {
 #if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
 	struct device *dev;
 #else
 	const struct device *dev;
 #endif
 	void *peer;
-	struct k_fifo *fifo;
 	struct k_sem sem;
-	struct uart_data *rx;
-} devs[2];
-
-// Two fifos for the data passing from the 91 out and in to the
-static K_FIFO_DEFINE(usb_0_tx_fifo);
-static K_FIFO_DEFINE(uart_0_tx_fifo);
+	// Forwards partially received data when the line goes idle.
+	struct k_timer idle_timer;
+	uint32_t idle_timeout_us;
+	// Data waiting to be sent out this device. Filled by the
+	// peer's ISR, drained by this device's ISR.
+	struct ring_buf *tx_ring;
+	struct k_spinlock tx_lock;
+	// Flow control watermarks for tx_ring.
+	uint32_t flow_high;
+	uint32_t flow_low;
+	// Set while receive is stopped because the data already
+	// waiting downstream passed the high watermark.
+	bool rx_throttled;
+	uint32_t throttle_cnt;
+	// Set on the CDC ACM side, which can't be throttled. Received
+	// data that doesn't fit in the peer's ring is counted in
+	// dropped.
+	bool is_cdc;
+	uint32_t dropped;
+	// Set on the USB side of a pair. Chunks are captured there
+	// since the CDC ACM moves whole blocks per call.
+	bool tap;
+	uint8_t tap_port;
+};
+
+static struct usb_uart_pair {
+	struct serial_dev usb;
+	struct serial_dev uart;
+	// Structures used to provide isr forwarding info
+	struct serial_isr_info isr_info[2];
+#ifdef CONFIG_UART_LINE_CTRL
+	// Host line settings last applied to the UART.
+	struct k_work line_work;
+	struct uart_config line_cfg;
+	uint32_t line_dtr, line_rts;
+#endif
+} pairs[USB_UART_PAIRS];
 
-// Structures used to provide isr forwarding info
-struct serial_isr_info isr_info[2];
+// Latency vs throughput tuning. See usb_uart_set_flush().
+static uint32_t flush_threshold = CONFIG_USB_UART_FLUSH_THRESHOLD;
 
-// Structures used for usb to uart relay.
-static struct serial_dev devs[2];
+/*
+ * rx_idle_restart - (Re)starts the idle timer of a device
+ * that is holding received data the peer hasn't been told
+ * about yet.
+ */
+static void rx_idle_restart(struct serial_dev *sd)
+{
+	if (sd->idle_timeout_us)
+	{
+		k_timer_start(&sd->idle_timer, K_USEC(sd->idle_timeout_us), K_NO_WAIT);
+	}
+}
 
-/* 
- * Frees data for incoming transmission on device blocked by full heap. 
+/*
+ * tx_pending - Returns the number of bytes waiting to be sent
+ * out a device. Called with the device's tx_lock held.
  */
-static int oom_free(struct serial_dev *sd)
+static uint32_t tx_pending(struct serial_dev *sd)
 {
-	struct serial_dev *peer_sd = (struct serial_dev *)sd->peer;
-	struct uart_data *buf;
+	return ring_buf_capacity_get(sd->tx_ring) - ring_buf_space_get(sd->tx_ring);
+}
 
-	/* First, try to free from FIFO of peer device (blocked stream) */
-	buf = k_fifo_get(peer_sd->fifo, K_NO_WAIT);
-	if (buf) {
-		k_free(buf);
-		return 0;
+/*
+ * flow_throttle - Stops receiving on a UART. With hardware flow
+ * control RTS is deasserted. Only used for the UART side: the
+ * CDC ACM class re-arms its OUT transfer on its own and drops
+ * what doesn't fit in its ring, so stopping reception there
+ * would only hide the loss. Called with the peer's tx_lock held.
+ */
+static void flow_throttle(struct serial_dev *sd)
+{
+	if (!sd->rx_throttled)
+	{
+		sd->rx_throttled = true;
+		sd->throttle_cnt++;
+		uart_irq_rx_disable(sd->dev);
 	}
+}
 
-	/* Then, try FIFO of the receiving device (reverse of blocked stream) */
-	buf = k_fifo_get(sd->fifo, K_NO_WAIT);
-	if (buf) {
-		k_free(buf);
-		return 0;
-	}
+/*
+ * flow_resume - Called after data has been sent out a device. If
+ * the peer that feeds this device was throttled and the data
+ * waiting has dropped to the low watermark, receiving restarts.
+ */
+static void flow_resume(struct serial_dev *sd)
+{
+	struct serial_dev *peer_sd = (struct serial_dev *)sd->peer;
+	k_spinlock_key_t key = k_spin_lock(&sd->tx_lock);
 
-	/* Finally, try all of them */
-	for (int i = 0; i < ARRAY_SIZE(devs); i++) {
-		buf = k_fifo_get(sd->fifo, K_NO_WAIT);
-		if (buf) {
-			k_free(buf);
-			return 0;
-		}
+	if (peer_sd->rx_throttled && (tx_pending(sd) <= sd->flow_low))
+	{
+		peer_sd->rx_throttled = false;
+		uart_irq_rx_enable(peer_sd->dev);
 	}
-
-	return -1; /* Was not able to free any heap memory */
+	k_spin_unlock(&sd->tx_lock, key);
 }
+
 /*
- * uart_usb_passthrough_isr - All UARTs on the 52840
- * must share one ISR. This code was orignally designed
- * to pass data from 2 uarts to 2 instances of the USB
- * virtual serial ports. 
- * 
- * In this design we use UART1 for interprocessor 
- * communication, UART1 follows the same design but
- * instead of forwarding received data to a corresponding 
- * USB-uart, it's rx fifo is read by another thread that 
- * processes incoming strings from the 9160.
- * 
- */ 
-static void uart_usb_passthrough_isr(void *user_data)
+ * uart_usb_ring_isr - ISR for both sides of every pair. All
+ * UARTs on the 52840 must share one ISR, so it is reached
+ * through serial_52lib.
+ *
+ * Received data is read directly into the contiguous free
+ * space of the peer's tx ring and transmitted data is sent
+ * directly from this device's tx ring, so no heap and no
+ * intermediate copies are needed.
+ */
+static void uart_usb_ring_isr(void *user_data)
 {
 	struct serial_dev *sd = user_data;
 #if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
 	struct device *dev = sd->dev;
 #else
 	const struct device *dev = sd->dev;
-#endif	
+#endif
 	struct serial_dev *peer_sd = (struct serial_dev *)sd->peer;
+	struct ring_buf *rx_ring = peer_sd->tx_ring;
+	k_spinlock_key_t key;
+	uint32_t rx_cnt = 0;
+	uint32_t space;
+	uint8_t *data;
+	uint8_t discard[32];
+	int len;
 
 	uart_irq_update(dev);
 
-	while (uart_irq_rx_ready(dev)) 
+	while (!sd->rx_throttled && uart_irq_rx_ready(dev))
 	{
-		int data_length;
-
-		while (!sd->rx) 
+		key = k_spin_lock(&peer_sd->tx_lock);
+		// Stop reading rather than drop data when the peer
+		// isn't keeping up.
+		if (!sd->is_cdc && (tx_pending(peer_sd) >= peer_sd->flow_high))
 		{
-			sd->rx = k_malloc(sizeof(*sd->rx));
-			if (sd->rx) 
-			{
-				sd->rx->len = 0;
-			} else 
-			{
-				int err = oom_free(sd);
+			flow_throttle(sd);
+			k_spin_unlock(&peer_sd->tx_lock, key);
+			break;
+		}
+		space = ring_buf_put_claim(rx_ring, &data, ring_buf_capacity_get(rx_ring));
+		k_spin_unlock(&peer_sd->tx_lock, key);
 
-				if (err) 
-				{
-					printk("Could not free memory. Rebooting.\n");
-					sys_reboot(SYS_REBOOT_COLD);
-				}
-			}
+		// The host can't be held off, so what doesn't fit is
+		// read and counted rather than lost in the USB stack.
+		if (space == 0)
+		{
+			len = uart_fifo_read(dev, discard, sizeof (discard));
+			if (len <= 0)
+				break;
+			sd->dropped += len;
+			continue;
 		}
 
-		data_length = uart_fifo_read(dev, &sd->rx->buffer[sd->rx->len],
-					   UART_BUF_SIZE - sd->rx->len);
-		sd->rx->len += data_length;
+		len = uart_fifo_read(dev, data, space);
+
+		key = k_spin_lock(&peer_sd->tx_lock);
+		ring_buf_put_finish(rx_ring, (len > 0) ? len : 0);
+		k_spin_unlock(&peer_sd->tx_lock, key);
+
+		if (len <= 0)
+			break;
+		if (sd->tap)
+			serial_tap_record(sd->tap_port, SERIAL_TAP_DIR_TO_9160, data, len);
+		rx_cnt += len;
+	}
 
-		if (sd->rx->len > 0) 
+	// Let the relay thread know the peer has data to send once
+	// enough has collected. Smaller amounts go when the line
+	// has been idle for idle_timeout_us.
+	if (rx_cnt)
+	{
+		uint32_t used = ring_buf_capacity_get(rx_ring) - ring_buf_space_get(rx_ring);
+
+		if ((used >= flush_threshold) || (sd->idle_timeout_us == 0))
 		{
-			if ((sd->rx->len == UART_BUF_SIZE) ||
-			   (sd->rx->buffer[sd->rx->len - 1] == '\n') ||
-			   (sd->rx->buffer[sd->rx->len - 1] == '\r') ||
-			   (sd->rx->buffer[sd->rx->len - 1] == '\0')) 
-			   {
-				k_fifo_put(peer_sd->fifo, sd->rx);
-				k_sem_give(&peer_sd->sem);
-
-				sd->rx = NULL;
-			}
+			k_timer_stop(&sd->idle_timer);
+			k_sem_give(&peer_sd->sem);
+		}
+		else
+		{
+			rx_idle_restart(sd);
 		}
 	}
 
-	if (uart_irq_tx_ready(dev)) 
+	if (uart_irq_tx_ready(dev))
 	{
-		struct uart_data *buf = k_fifo_get(sd->fifo, K_NO_WAIT);
-		uint16_t written = 0;
+		key = k_spin_lock(&sd->tx_lock);
+		len = ring_buf_get_claim(sd->tx_ring, &data, ring_buf_capacity_get(sd->tx_ring));
+		k_spin_unlock(&sd->tx_lock, key);
 
-		/* Nothing in the FIFO, nothing to send */
-		if (!buf) 
+		/* Nothing in the ring, nothing to send */
+		if (len == 0)
 		{
 			uart_irq_tx_disable(dev);
 			return;
 		}
 
-		while (buf->len > written) 
-		{
-			written += uart_fifo_fill(dev,
-						  &buf->buffer[written],
-						  buf->len - written);
-		}
+		// Send what the device will take. The rest goes out
+		// on the next tx ready interrupt.
+		len = uart_fifo_fill(dev, data, len);
+		if (sd->tap && (len > 0))
+			serial_tap_record(sd->tap_port, SERIAL_TAP_DIR_FROM_9160, data, len);
+
+		key = k_spin_lock(&sd->tx_lock);
+		ring_buf_get_finish(sd->tx_ring, (len > 0) ? len : 0);
+		k_spin_unlock(&sd->tx_lock, key);
+
+		flow_resume(sd);
+	}
+}
+
+/*
+ * rx_idle_handler - Timer handler called when no data has been
+ * received for idle_timeout_us. Tells the peer to send whatever
+ * has been collected.
+ */
+static void rx_idle_handler(struct k_timer *timer)
+{
+	struct serial_dev *sd = k_timer_user_data_get(timer);
+	struct serial_dev *peer_sd = (struct serial_dev *)sd->peer;
+
+	k_sem_give(&peer_sd->sem);
+}
+
+/*
+ * usb_uart_set_flush - Sets, for every pair, how long the line
+ * must be idle before partially received data is forwarded and
+ * how many bytes must collect before they are forwarded without
+ * waiting for the line to idle.
+ */
+void usb_uart_set_flush(uint32_t idle_us, uint32_t threshold)
+{
+	for (int i = 0; i < USB_UART_PAIRS; i++)
+	{
+		pairs[i].usb.idle_timeout_us = idle_us;
+		pairs[i].uart.idle_timeout_us = idle_us;
+	}
+	flush_threshold = (threshold > 0) ? threshold : 1;
+}
+
+/*
+ * usb_uart_get_stats - Reads the flow control counters of a pair.
+ */
+int usb_uart_get_stats(int pair, struct usb_uart_stats *stats)
+{
+	unsigned int key;
+
+	if ((pair < 0) || (pair >= USB_UART_PAIRS))
+		return -EINVAL;
+
+	key = irq_lock();
+	stats->uart_throttled = pairs[pair].uart.throttle_cnt;
+	stats->usb_dropped = pairs[pair].usb.dropped;
+	irq_unlock(key);
+	return 0;
+}
+
+#ifdef CONFIG_UART_LINE_CTRL
+/*
+ * Host line settings. The CDC ACM device reports a baud rate
+ * change through the DTE rate callback. Parity, stop bits and
+ * the control lines have no callback, so they are also sampled
+ * every CONFIG_USB_UART_LINE_POLL_MS.
+ */
+static struct k_timer line_timer;
+
+/*
+ * line_work_handler - Applies the host's line coding to the
+ * UART of a pair and forwards DTR/RTS. Runs in the system
+ * work queue since uart_configure can't be called from an ISR.
+ */
+static void line_work_handler(struct k_work *work)
+{
+	struct usb_uart_pair *pair = CONTAINER_OF(work, struct usb_uart_pair, line_work);
+	struct serial_dev *usb_sd = &pair->usb;
+	struct serial_dev *uart_sd = &pair->uart;
+	struct uart_config cfg;
+	uint32_t val;
+	int ret;
 
-		while (!uart_irq_tx_complete(dev)) 
+	// Start from the UART's settings so that flow control, and
+	// anything the CDC ACM doesn't report, is left alone.
+	if (uart_config_get(uart_sd->dev, &cfg) != 0)
+		return;
+
+	if (uart_line_ctrl_get(usb_sd->dev, UART_LINE_CTRL_BAUD_RATE, &val) == 0)
+	{
+		cfg.baudrate = val;
+	}
+	{
+		struct uart_config usb_cfg;
+
+		// Not all CDC ACM versions report the line coding.
+		if (uart_config_get(usb_sd->dev, &usb_cfg) == 0)
 		{
-			/* Wait for the last byte to get
-			 * shifted out of the module
-			 */
+			cfg.parity = usb_cfg.parity;
+			cfg.stop_bits = usb_cfg.stop_bits;
+			cfg.data_bits = usb_cfg.data_bits;
 		}
+	}
 
-		if (k_fifo_is_empty(sd->fifo)) 
+	if ((cfg.baudrate != 0) && memcmp(&cfg, &pair->line_cfg, sizeof(cfg)))
+	{
+		ret = uart_configure(uart_sd->dev, &cfg);
+		if (ret != 0)
 		{
-			uart_irq_tx_disable(dev);
+			printk("UART can't be set to %d baud (%d)\n", cfg.baudrate, ret);
 		}
+		// Don't retry a failed setting on every poll.
+		pair->line_cfg = cfg;
+	}
+
+	// Forward the control lines. The nRF UARTE has no DTR and
+	// drives RTS itself, so -ENOTSUP is expected there.
+	if ((uart_line_ctrl_get(usb_sd->dev, UART_LINE_CTRL_DTR, &val) == 0) &&
+	    (val != pair->line_dtr))
+	{
+		pair->line_dtr = val;
+		uart_line_ctrl_set(uart_sd->dev, UART_LINE_CTRL_DTR, val);
+	}
+	if ((uart_line_ctrl_get(usb_sd->dev, UART_LINE_CTRL_RTS, &val) == 0) &&
+	    (val != pair->line_rts))
+	{
+		pair->line_rts = val;
+		uart_line_ctrl_set(uart_sd->dev, UART_LINE_CTRL_RTS, val);
+	}
+}
 
-		k_free(buf);
+static void line_timer_handler(struct k_timer *timer)
+{
+	for (int i = 0; i < USB_UART_PAIRS; i++)
+	{
+		if (pairs[i].usb.dev && pairs[i].uart.dev)
+			k_work_submit(&pairs[i].line_work);
 	}
 }
 
+#ifdef CONFIG_CDC_ACM_DTE_RATE_CALLBACK_SUPPORT
+#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
+static void line_rate_cb(struct device *dev, uint32_t rate)
+#else
+static void line_rate_cb(const struct device *dev, uint32_t rate)
+#endif
+{
+	for (int i = 0; i < USB_UART_PAIRS; i++)
+	{
+		if (pairs[i].usb.dev == dev)
+			k_work_submit(&pairs[i].line_work);
+	}
+}
+#endif //CONFIG_CDC_ACM_DTE_RATE_CALLBACK_SUPPORT
+
+/*
+ * line_coding_init - Sets up a pair to follow the host's line
+ * settings and tells the host the line is up.
+ */
+static void line_coding_init(struct usb_uart_pair *pair)
+{
+	// Remember the devicetree settings so the first poll
+	// only reconfigures if the host asked for something else.
+	uart_config_get(pair->uart.dev, &pair->line_cfg);
+
+	// Report carrier and DSR to the host.
+	uart_line_ctrl_set(pair->usb.dev, UART_LINE_CTRL_DCD, 1);
+	uart_line_ctrl_set(pair->usb.dev, UART_LINE_CTRL_DSR, 1);
+
+#ifdef CONFIG_CDC_ACM_DTE_RATE_CALLBACK_SUPPORT
+	cdc_acm_dte_rate_callback_set(pair->usb.dev, line_rate_cb);
+#endif
+}
+#endif //CONFIG_UART_LINE_CTRL
+
 static K_THREAD_STACK_DEFINE(uart_thread_stack, /*CONFIG_BT_HCI_TX_STACK_SIZE*/ 1536);
 static struct k_thread uart_thread_data;
 
@@ -197,7 +571,7 @@ static void usb_uart_thread(void *p1, void *p2, void *p3);
 
 void usb_uart_init(void)
 {
-	// Spawn the uart thread 
+	// Spawn the uart thread
 	//
 	k_thread_create(&uart_thread_data, uart_thread_stack,
 			K_THREAD_STACK_SIZEOF(uart_thread_stack), usb_uart_thread, NULL,
@@ -206,31 +580,114 @@ void usb_uart_init(void)
 	return;
 }
 
+/*
+ * serial_dev_init - Sets up one side of a pair.
+ */
+static void serial_dev_init(struct serial_dev *sd, struct serial_dev *peer_sd,
+                            const char *name, struct ring_buf *tx_ring,
+                            const struct usb_uart_pair_cfg *cfg)
+{
+	sd->dev = device_get_binding(name);
+	if (!sd->dev) {
+		printk("%s init failed\n", name);
+	}
+	sd->peer = peer_sd;
+	sd->tx_ring = tx_ring;
+	sd->flow_high = cfg->flow_high;
+	sd->flow_low = cfg->flow_low;
+	sd->idle_timeout_us = cfg->idle_timeout_us;
+
+	k_sem_init(&sd->sem, 0, 1);
+	k_timer_init(&sd->idle_timer, rx_idle_handler, NULL);
+	k_timer_user_data_set(&sd->idle_timer, sd);
+}
+
+/*
+ * bridge_start - Powers up the devices of every pair and starts
+ * relaying. Anything left from before a disconnect is dropped.
+ */
+static void bridge_start(void)
+{
+	for (int i = 0; i < USB_UART_PAIRS; i++)
+	{
+		struct usb_uart_pair *pair = &pairs[i];
+
+		if (!pair->usb.dev || !pair->uart.dev)
+			continue;
+
+		device_set_power_state(pair->usb.dev, DEVICE_PM_ACTIVE_STATE,
+		                       NULL, NULL);
+		device_set_power_state(pair->uart.dev, DEVICE_PM_ACTIVE_STATE,
+		                       NULL, NULL);
+		ring_buf_reset(pair->usb.tx_ring);
+		ring_buf_reset(pair->uart.tx_ring);
+		pair->usb.rx_throttled = false;
+		pair->uart.rx_throttled = false;
+
+		uart_irq_rx_enable(pair->usb.dev);
+		uart_irq_rx_enable(pair->uart.dev);
+#ifdef CONFIG_UART_LINE_CTRL
+		line_coding_init(pair);
+#endif
+	}
+#ifdef CONFIG_UART_LINE_CTRL
+	if (CONFIG_USB_UART_LINE_POLL_MS > 0)
+	{
+		k_timer_start(&line_timer, K_MSEC(CONFIG_USB_UART_LINE_POLL_MS),
+		              K_MSEC(CONFIG_USB_UART_LINE_POLL_MS));
+	}
+#endif
+}
+
+/*
+ * bridge_stop - Stops relaying and puts the devices of every
+ * pair in low power while the USB is unplugged.
+ */
+static void bridge_stop(void)
+{
+#ifdef CONFIG_UART_LINE_CTRL
+	k_timer_stop(&line_timer);
+#endif
+	for (int i = 0; i < USB_UART_PAIRS; i++)
+	{
+		struct serial_dev *sides[2] = { &pairs[i].usb, &pairs[i].uart };
+
+		for (int j = 0; j < 2; j++)
+		{
+			if (!sides[j]->dev)
+				continue;
+
+			k_timer_stop(&sides[j]->idle_timer);
+			uart_irq_rx_disable(sides[j]->dev);
+			uart_irq_tx_disable(sides[j]->dev);
+			device_set_power_state(sides[j]->dev, DEVICE_PM_LOW_POWER_STATE,
+			                       NULL, NULL);
+		}
+	}
+}
+
 /*
  * usb_uart_thread - Initializes the USB and UART drivers
  * used for communication. Since all UARTs on the 52840
- * must share one ISR, the code is designed to have 
- * symetric code that links the uart and USB-uart that 
+ * must share one ISR, the code is designed to have
+ * symetric code that links the uart and USB-uart that
  * are to relay data.
- * 
+ *
  * For interprocessor communication, UART1 follows the same
- * design but instead of forwarding received data to a 
+ * design but instead of forwarding received data to a
  * corresponding USB-uart, it's rx fifo is read by another
  * thread that processes incoming strings from the 9160.
- * 
- * If the USB isn't connected, the USB and paired UART
- * are not initialized.
- */ 
+ *
+ * While the USB is unplugged the devices are kept in low
+ * power. Relaying restarts when it is plugged in again.
+ */
 static void usb_uart_thread(void *p1, void *p2, void *p3)
 {
-	int ret;
-	struct serial_dev *usb_0_sd = &devs[0];
-	struct serial_dev *uart_0_sd = &devs[1];
-#if (NRF_VERSION_MAJOR == 1) && (NRF_VERSION_MINOR < 4)
-	struct device *usb_passthru_dev, *uart_passthru_dev;
-#else
-	const struct device *usb_passthru_dev, *uart_passthru_dev;
-#endif
+	// One event per device plus the power event.
+	static struct k_poll_event events[2 * USB_UART_PAIRS + 1];
+	struct serial_dev *sd;
+	int active = 0;
+	int i, ret;
 
 	// Init the 52840 common serial library.
 	serial_lib_init();
@@ -238,103 +695,107 @@ static void usb_uart_thread(void *p1, void *p2, void *p3)
 	// we get the uart and usb devices even if the
 	// USB is unplugged so that we can power them
 	// down later in this routine.
-
-	usb_passthru_dev = device_get_binding(CONFIG_PASSTHROUGH_USB_DEV_NAME);
-	if (!usb_passthru_dev) {
-		printk("%s init failed\n", CONFIG_PASSTHROUGH_USB_DEV_NAME);
+	for (i = 0; i < USB_UART_PAIRS; i++)
+	{
+		struct usb_uart_pair *pair = &pairs[i];
+
+		serial_dev_init(&pair->usb, &pair->uart, pair_cfg[i].usb_name,
+		                pair_cfg[i].usb_tx_ring, &pair_cfg[i]);
+		serial_dev_init(&pair->uart, &pair->usb, pair_cfg[i].uart_name,
+		                pair_cfg[i].uart_tx_ring, &pair_cfg[i]);
+		pair->usb.tap = true;
+		pair->usb.is_cdc = true;
+		pair->usb.tap_port = SERIAL_TAP_PORT_BRIDGE + i;
+
+		// Now init the struct to pass to the isr handler.
+		pair->isr_info[0].irq_fn = uart_usb_ring_isr;
+		pair->isr_info[0].user_data = &pair->usb;
+		pair->isr_info[1].irq_fn = uart_usb_ring_isr;
+		pair->isr_info[1].user_data = &pair->uart;
+
+		k_poll_event_init(&events[2 * i], K_POLL_TYPE_SEM_AVAILABLE,
+		                  K_POLL_MODE_NOTIFY_ONLY, &pair->usb.sem);
+		k_poll_event_init(&events[2 * i + 1], K_POLL_TYPE_SEM_AVAILABLE,
+		                  K_POLL_MODE_NOTIFY_ONLY, &pair->uart.sem);
+
+#ifdef CONFIG_UART_LINE_CTRL
+		k_work_init(&pair->line_work, line_work_handler);
+#endif
+		if (pair->usb.dev && pair->uart.dev)
+		{
+			serial_lib_register_isr (pair->usb.dev, &pair->isr_info[0]);
+			serial_lib_register_isr (pair->uart.dev, &pair->isr_info[1]);
+			active++;
+		}
 	}
+	k_poll_event_init(&events[2 * USB_UART_PAIRS], K_POLL_TYPE_SEM_AVAILABLE,
+	                  K_POLL_MODE_NOTIFY_ONLY, &power_event_sem);
 
-	uart_passthru_dev = device_get_binding(CONFIG_PASSTHROUGH_UART_DEV_NAME);
-	if (!uart_passthru_dev) {
-		printk("%s init failed\n", CONFIG_PASSTHROUGH_UART_DEV_NAME);
+	if (!active)
+	{
+#ifdef CONFIG_USB_UART_TRACE
+		// Trace only.
+		if (common_init_usb () == 0)
+			usb_uart_trace_init();
+#endif
+		return;
 	}
 
-	usb_0_sd->dev = usb_passthru_dev;
-	usb_0_sd->fifo = &usb_0_tx_fifo;
-	usb_0_sd->peer = uart_0_sd;
-
-	uart_0_sd->dev = uart_passthru_dev;
-	uart_0_sd->fifo = &uart_0_tx_fifo;
-	uart_0_sd->peer = usb_0_sd;
-
-	k_sem_init(&usb_0_sd->sem, 0, 1);
-	k_sem_init(&uart_0_sd->sem, 0, 1);
-
-	// Now init the struct to pass to the isr handler.
-	isr_info[0].irq_fn = uart_usb_passthrough_isr;
-	isr_info[0].user_data = usb_0_sd;
-
-	isr_info[1].irq_fn = uart_usb_passthrough_isr;
-	isr_info[1].user_data = uart_0_sd;
-
-	if (usb_passthru_dev && uart_passthru_dev)  
+#ifdef CONFIG_UART_LINE_CTRL
+	k_timer_init(&line_timer, line_timer_handler, NULL);
+#endif
+	// The USB is enabled even if it's unplugged so that the
+	// stack reports when it is plugged in.
+	ret = common_init_usb ();
+	if (ret != 0)
 	{
-		serial_lib_register_isr (usb_passthru_dev, &isr_info[0]);
-		serial_lib_register_isr (uart_passthru_dev, &isr_info[1]);
+		printk("Failed to enable USB\n");
+		USB_active = 0;
+		bridge_stop();
+		return;
+	}
+#ifdef CONFIG_USB_UART_TRACE
+	usb_uart_trace_init();
+#endif
 
-		ret = common_init_usb ();
-		if (ret != 0) 
+	while (1)
+	{
+		// Wait for the USB to be plugged in. power_event_sem
+		// is given on every VBUS change.
+		if (!USB_active)
 		{
-			USB_active = 0;
-			printk("Failed to enable USB\n");
+			bridge_stop();
+			while (!USB_active)
+				k_sem_take(&power_event_sem, K_FOREVER);
 		}
-	}
+		bridge_start();
+		printk("USB <--> UART bridge is now initialized, %d pair(s)\n", active);
 
-	if (usb_passthru_dev && uart_passthru_dev)  
-	{
-		uart_irq_rx_enable(usb_passthru_dev);
-		uart_irq_rx_enable(uart_passthru_dev);
-
-		printk("USB <--> UART bridge is now initialized\n");
-
-		struct k_poll_event events[3] = {
-			K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_SEM_AVAILABLE,
-							K_POLL_MODE_NOTIFY_ONLY,
-							&usb_0_sd->sem, 0),
-			K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_SEM_AVAILABLE,
-							K_POLL_MODE_NOTIFY_ONLY,
-							&uart_0_sd->sem, 0),
-			K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_SEM_AVAILABLE,
-							K_POLL_MODE_NOTIFY_ONLY,
-							&power_event_sem, 0),
-		};
-
-		while (USB_active && usb_passthru_dev && uart_passthru_dev) 
+		while (USB_active)
 		{
 			ret = k_poll(events, ARRAY_SIZE(events), K_FOREVER);
 			if (ret != 0) {
 				k_sleep(K_MSEC(100));
 				continue;
 			}
-			if (events[0].state == K_POLL_TYPE_SEM_AVAILABLE) {
-				events[0].state = K_POLL_STATE_NOT_READY;
-				k_sem_take(&usb_0_sd->sem, K_NO_WAIT);
-				uart_irq_tx_enable(usb_passthru_dev);
-			} else if (events[1].state == K_POLL_TYPE_SEM_AVAILABLE) {
-				events[1].state = K_POLL_STATE_NOT_READY;
-				k_sem_take(&uart_0_sd->sem, K_NO_WAIT);
-				uart_irq_tx_enable(uart_passthru_dev);
-			} else if (events[2].state == K_POLL_TYPE_SEM_AVAILABLE) {
-				events[1].state = K_POLL_STATE_NOT_READY;
 
-				break;
+			// Service every device that has data waiting, not
+			// just the first one found.
+			for (i = 0; i < 2 * USB_UART_PAIRS; i++)
+			{
+				if (events[i].state != K_POLL_STATE_SEM_AVAILABLE)
+					continue;
+
+				events[i].state = K_POLL_STATE_NOT_READY;
+				sd = CONTAINER_OF(events[i].sem, struct serial_dev, sem);
+				k_sem_take(&sd->sem, K_NO_WAIT);
+				uart_irq_tx_enable(sd->dev);
+			}
+			if (events[2 * USB_UART_PAIRS].state == K_POLL_STATE_SEM_AVAILABLE) {
+				events[2 * USB_UART_PAIRS].state = K_POLL_STATE_NOT_READY;
+				k_sem_take(&power_event_sem, K_NO_WAIT);
 			}
 		}
-	}
-	if (usb_passthru_dev)
-		uart_irq_rx_disable(usb_passthru_dev);
-	if (uart_passthru_dev)
-		uart_irq_rx_disable(uart_passthru_dev);
-
-	if (usb_passthru_dev)
-	{
-		device_set_power_state(usb_passthru_dev, DEVICE_PM_LOW_POWER_STATE, 
-		                       NULL, NULL);
-	}	
-
-	if (uart_passthru_dev)
-	{
-		device_set_power_state(uart_passthru_dev, DEVICE_PM_LOW_POWER_STATE, 
-	                           NULL, NULL);
+		printk("USB <--> UART bridge stopped, USB removed\n");
 	}
 }